@@ -0,0 +1,33 @@
+# Writes a SPIR-V binary out as a C++ include holding its words in a constexpr uint32_t array, so the module can be
+# created straight from the executable image.
+# Usage: cmake -DINPUT=<file.spv> -DOUTPUT=<file.inc> -DSYMBOL=<identifier> -P EmbedSpirv.cmake
+
+file(READ "${INPUT}" contents HEX)
+string(LENGTH "${contents}" length)
+math(EXPR remainder "${length} % 8")
+string(SUBSTRING "${contents}" 0 8 magic)
+# The file is little-endian, so the magic number 0x07230203 reads back as 03022307.
+if(length EQUAL 0 OR NOT remainder EQUAL 0 OR NOT magic STREQUAL "03022307")
+  message(FATAL_ERROR "${INPUT} is not a little-endian SPIR-V binary")
+endif()
+
+string(REGEX MATCHALL "........" words "${contents}")
+set(body "")
+set(column 0)
+foreach(word IN LISTS words)
+  string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1" word "${word}")
+  if(column EQUAL 0)
+    string(APPEND body "\t${word},")
+  else()
+    string(APPEND body " ${word},")
+  endif()
+  math(EXPR column "(${column} + 1) % 8")
+  if(column EQUAL 0)
+    string(APPEND body "\n")
+  endif()
+endforeach()
+if(NOT column EQUAL 0)
+  string(APPEND body "\n")
+endif()
+
+file(WRITE "${OUTPUT}" "alignas(4) static constexpr uint32_t ${SYMBOL}[] = {\n${body}};\n")
@@ -1,6 +1,16 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#ifdef EMBEDDED_SHADERS
+#include "embedded_shaders.h"
+#endif
+
 #include <iostream>
 #include <stdexcept>
 #include <functional>
@@ -9,9 +19,30 @@
 #include <string>
 #include <set>
 #include <fstream>
+#include <chrono>
+#include <iomanip>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <cctype>
+#include <limits>
+#include <cmath>
+#include <sstream>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <exception>
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
+// Every window adds its graph steps to the GPU profiler's per-frame scopes.
+const uint32_t MAX_WINDOWS = 8;
 
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_LUNARG_standard_validation"
@@ -27,19 +58,156 @@ const bool enableValidationLayers = false;
 const bool enableValidationLayers = true;
 #endif
 
-static std::vector<char> readFile(const std::string& filename) {
-	std::ifstream stream(filename, std::ios::in | std::ios::binary);
+struct Vertex {
+	float pos[2];
+	float color[3];
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(Vertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(Vertex, pos);
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(Vertex, color);
+		return attributeDescriptions;
+	}
+};
+
+// Per-instance attributes, streamed every frame through an instance-rate vertex buffer.
+struct InstanceData {
+	float offset[2];
+	float scale;
+	float rotation;
+	uint32_t color;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+		attributeDescriptions[0].binding = 1;
+		attributeDescriptions[0].location = 2;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(InstanceData, offset);
+		attributeDescriptions[1].binding = 1;
+		attributeDescriptions[1].location = 3;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(InstanceData, scale);
+		attributeDescriptions[2].binding = 1;
+		attributeDescriptions[2].location = 4;
+		attributeDescriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+		attributeDescriptions[2].offset = offsetof(InstanceData, color);
+		return attributeDescriptions;
+	}
+};
+
+// Push constants shared by the culling compute shader and the vertex shader. The view maps instance space to clip
+// space; instanceCount is only read by the culling pass.
+struct ViewConstants {
+	float center[2];
+	float zoom;
+	uint32_t instanceCount;
+};
+
+// Push constants of the upscale fragment shader. uvScale maps a swapchain pixel to the part of the scene target that
+// was drawn; uvMax keeps bilinear filtering from reading past that part.
+struct UpscaleConstants {
+	float uvScale[2];
+	float uvMax[2];
+};
+
+// Per-draw data read through a dynamic uniform buffer offset; padded to a 16-byte std140 block.
+struct ObjectUniforms {
+	float offset[2];
+	float brightness;
+	float padding;
+};
+
+// Simulation state of one particle; only ever touched by the compute queue.
+struct Particle {
+	float position[2];
+	float velocity[2];
+};
+
+// What the graphics queue draws for a particle: a colored point.
+struct ParticleVertex {
+	float position[2];
+	uint32_t color;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(ParticleVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(ParticleVertex, position);
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+		attributeDescriptions[1].offset = offsetof(ParticleVertex, color);
+		return attributeDescriptions;
+	}
+};
+
+const std::vector<Vertex> vertices = {
+	{ { 0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+	{ { 0.5f, 0.5f }, { 0.0f, 1.0f, 0.0f } },
+	{ { -0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f } }
+};
+
+const std::vector<uint16_t> indices = {
+	0, 1, 2
+};
+
+// Reads a SPIR-V file in one call straight into word storage, so the code pointer handed to Vulkan is 4-byte aligned.
+static std::vector<uint32_t> readSpirvFile(const std::string& filename) {
+	std::ifstream stream(filename, std::ios::in | std::ios::binary | std::ios::ate);
 	if (!stream.is_open()) {
-		throw std::runtime_error("failed to open file!");
+		throw std::runtime_error("failed to open file " + filename + "!");
+	}
+	std::streamsize size = stream.tellg();
+	if (size <= 0 || size % sizeof(uint32_t) != 0) {
+		throw std::runtime_error(filename + " is not a SPIR-V binary!");
+	}
+	std::vector<uint32_t> words(static_cast<size_t>(size) / sizeof(uint32_t));
+	stream.seekg(0);
+	if (!stream.read(reinterpret_cast<char*>(words.data()), size)) {
+		throw std::runtime_error("failed to read file " + filename + "!");
 	}
-	std::vector<char> contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-	stream.close();
-	return contents;
+	return words;
 }
 
 struct QueueFamilyIndices {
 	int graphics = -1;
 	int present = -1;
+	// A transfer-only family when the device has one (typically a DMA engine), otherwise the graphics family.
+	int transfer = -1;
+	// A compute family without graphics when the device has one, so simulation can overlap rasterization; otherwise
+	// the graphics family.
+	int compute = -1;
 
 	bool isComplete() {
 		return graphics >= 0 && present >= 0;
@@ -52,20 +220,48 @@ struct QueueFamilyIndices {
 		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
 		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
 		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-		int i = 0;
-		for (const auto& queueFamily : queueFamilies) {
+		// The graphics family also has to run the culling compute pass. A family that can present as well is preferred
+		// over the first graphics family, since splitting graphics and present forces concurrent swapchain sharing.
+		for (uint32_t i = 0; i < queueFamilyCount; i++) {
+			const auto& queueFamily = queueFamilies[i];
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-			if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			if (surface != VK_NULL_HANDLE) {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			}
+			bool graphicsSupport = queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+			if (graphicsSupport && (presentSupport || surface == VK_NULL_HANDLE)) {
+				indices.graphics = i;
+				indices.present = i;
+				break;
+			}
+			if (graphicsSupport && indices.graphics < 0) {
 				indices.graphics = i;
 			}
-			if (queueFamily.queueCount > 0 && presentSupport) {
+			if (queueFamily.queueCount > 0 && presentSupport && indices.present < 0) {
 				indices.present = i;
 			}
-			if (indices.isComplete()) {
+		}
+
+		for (uint32_t j = 0; j < queueFamilyCount; j++) {
+			VkQueueFlags flags = queueFamilies[j].queueFlags;
+			if (queueFamilies[j].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+				indices.transfer = j;
+				break;
+			}
+		}
+		if (indices.transfer < 0) {
+			indices.transfer = indices.graphics;
+		}
+
+		for (uint32_t j = 0; j < queueFamilyCount; j++) {
+			VkQueueFlags flags = queueFamilies[j].queueFlags;
+			if (queueFamilies[j].queueCount > 0 && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+				indices.compute = j;
 				break;
 			}
-			i++;
+		}
+		if (indices.compute < 0) {
+			indices.compute = indices.graphics;
 		}
 
 		return indices;
@@ -98,14 +294,31 @@ struct PhysicalDeviceContext {
 	VkPhysicalDevice physicalDevice;
 	QueueFamilyIndices queueFamilyIndices;
 	SwapChainSupportDetails swapChainCapabilities;
-	
-	static bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceFeatures features;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	std::vector<const char*> extensions;
+	// VK_KHR_draw_indirect_count or its AMD predecessor when the device has either, otherwise null.
+	const char* drawIndirectCountExtension;
+	// VK_KHR_timeline_semaphore on devices older than Vulkan 1.2, where timeline semaphores are not core; otherwise null.
+	const char* timelineSemaphoreExtension;
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	static bool checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& requiredExtensions) {
 		uint32_t extensionCount;
 		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 		std::vector<VkExtensionProperties> extensions(extensionCount);
 		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
 
-		std::vector<const char*> requestedExtensions(deviceExtensions);
+		std::vector<const char*> requestedExtensions(requiredExtensions);
 		auto presentExtensions = std::remove_if(requestedExtensions.begin(), requestedExtensions.end(), [&](const char* ext) {
 			auto result = std::find_if(extensions.begin(), extensions.end(), [&](VkExtensionProperties props) {
 				return strcmp(ext, props.extensionName) == 0;
@@ -116,7 +329,142 @@ struct PhysicalDeviceContext {
 		return requestedExtensions.empty();
 	}
 
-	static PhysicalDeviceContext findBest(VkInstance instance, VkSurfaceKHR surface) {
+	static const char* deviceTypeName(VkPhysicalDeviceType type) {
+		switch (type) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+		default: return "other";
+		}
+	}
+
+	// Fills ctx for a device, or returns false with the reason it cannot be used.
+	static bool inspect(VkPhysicalDevice device, VkSurfaceKHR surface, const std::vector<const char*>& requiredExtensions,
+		PhysicalDeviceContext& ctx, std::string& rejection) {
+		ctx = {};
+		ctx.physicalDevice = device;
+		vkGetPhysicalDeviceProperties(device, &ctx.properties);
+		vkGetPhysicalDeviceFeatures(device, &ctx.features);
+		vkGetPhysicalDeviceMemoryProperties(device, &ctx.memoryProperties);
+
+		ctx.queueFamilyIndices = QueueFamilyIndices::findQueueFamilies(surface, device);
+		if (ctx.queueFamilyIndices.graphics < 0) {
+			rejection = "no queue family supports both graphics and compute";
+			return false;
+		}
+		if (ctx.queueFamilyIndices.present < 0) {
+			rejection = "no queue family can present to the surface";
+			return false;
+		}
+		if (!checkDeviceExtensionSupport(device, requiredExtensions)) {
+			rejection = "missing required device extensions";
+			return false;
+		}
+		if (surface != VK_NULL_HANDLE) {
+			ctx.swapChainCapabilities = SwapChainSupportDetails::querySwapChainSupport(surface, device);
+			if (ctx.swapChainCapabilities.formats.empty() || ctx.swapChainCapabilities.presentModes.empty()) {
+				rejection = "no surface formats or present modes";
+				return false;
+			}
+		}
+
+		// All queue synchronization goes through timeline semaphores.
+		uint32_t apiVersion = ctx.properties.apiVersion;
+		if (VK_VERSION_MAJOR(apiVersion) == 1 && VK_VERSION_MINOR(apiVersion) < 1) {
+			rejection = "Vulkan 1.1 is required";
+			return false;
+		}
+		ctx.extensions = requiredExtensions;
+		if (VK_VERSION_MAJOR(apiVersion) == 1 && VK_VERSION_MINOR(apiVersion) < 2) {
+			if (!checkDeviceExtensionSupport(device, { VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME })) {
+				rejection = "no timeline semaphore support";
+				return false;
+			}
+			ctx.timelineSemaphoreExtension = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+			ctx.extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		}
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &timelineFeatures;
+		vkGetPhysicalDeviceFeatures2(device, &features2);
+		if (!timelineFeatures.timelineSemaphore) {
+			rejection = "timeline semaphores are not enabled by the driver";
+			return false;
+		}
+
+		for (const char* extension : { VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME }) {
+			if (checkDeviceExtensionSupport(device, { extension })) {
+				ctx.drawIndirectCountExtension = extension;
+				ctx.extensions.push_back(extension);
+				break;
+			}
+		}
+		return true;
+	}
+
+	// Device type dominates, so a discrete GPU always beats an integrated one; within a type, a single graphics and
+	// present family outweighs everything else, followed by device-local memory, limits and optional capabilities.
+	int64_t score(std::string& breakdown) const {
+		std::ostringstream terms;
+		int64_t total = 0;
+		auto add = [&](const char* name, int64_t value) {
+			if (value != 0) {
+				total += value;
+				terms << (terms.tellp() > 0 ? ", " : "") << name << " " << value;
+			}
+		};
+
+		switch (properties.deviceType) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: add("type", 1000000); break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: add("type", 100000); break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: add("type", 50000); break;
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: add("type", 1000); break;
+		default: break;
+		}
+		if (queueFamilyIndices.graphics == queueFamilyIndices.present) {
+			add("unified graphics/present family", 20000);
+		}
+		if (queueFamilyIndices.transfer != queueFamilyIndices.graphics) {
+			add("dedicated transfer family", 1000);
+		}
+		if (queueFamilyIndices.compute != queueFamilyIndices.graphics) {
+			add("async compute family", 1000);
+		}
+
+		VkDeviceSize deviceLocalBytes = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+				deviceLocalBytes = std::max(deviceLocalBytes, memoryProperties.memoryHeaps[i].size);
+			}
+		}
+		add("device-local MiB/16", static_cast<int64_t>(deviceLocalBytes / (16 * 1024 * 1024)));
+		add("max 2D image/256", properties.limits.maxImageDimension2D / 256);
+		add("max compute invocations/64", properties.limits.maxComputeWorkGroupInvocations / 64);
+		if (drawIndirectCountExtension != nullptr) {
+			add("indirect count", 500);
+		}
+		if (features.pipelineStatisticsQuery) {
+			add("pipeline statistics", 100);
+		}
+
+		breakdown = terms.str();
+		return total;
+	}
+
+	static bool matchesSelector(const std::string& selector, uint32_t index, const char* deviceName) {
+		if (!selector.empty() && selector.find_first_not_of("0123456789") == std::string::npos) {
+			return strtoul(selector.c_str(), nullptr, 10) == index;
+		}
+		return std::string(deviceName).find(selector) != std::string::npos;
+	}
+
+	// Pass a null surface to select a device for headless rendering, which has no present or swapchain requirements.
+	// The selector (an index or a substring of the device name) overrides scoring; when it is empty the
+	// VK_PHYSICAL_DEVICE environment variable is used instead.
+	static PhysicalDeviceContext findBest(VkInstance instance, VkSurfaceKHR surface, std::string selector) {
 		uint32_t deviceCount = 0;
 		vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 		if (deviceCount == 0) {
@@ -124,22 +472,359 @@ struct PhysicalDeviceContext {
 		}
 		std::vector<VkPhysicalDevice> devices(deviceCount);
 		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-		for (const auto& device : devices) {
-			QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(surface, device);
-			bool extensionsSupported = checkDeviceExtensionSupport(device);
-			if (indices.isComplete() && extensionsSupported) {
-				SwapChainSupportDetails swapChainSupport = SwapChainSupportDetails::querySwapChainSupport(surface, device);
-				if (!swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty()) {
-					PhysicalDeviceContext ctx = {};
-					ctx.physicalDevice = device;
-					ctx.queueFamilyIndices = indices;
-					ctx.swapChainCapabilities = swapChainSupport;
-					return ctx;
+
+		std::vector<const char*> requiredExtensions;
+		if (surface != VK_NULL_HANDLE) {
+			requiredExtensions = deviceExtensions;
+		}
+		if (selector.empty()) {
+#ifdef _WIN32
+			char* value = nullptr;
+			size_t length = 0;
+			if (_dupenv_s(&value, &length, "VK_PHYSICAL_DEVICE") == 0 && value != nullptr) {
+				selector = value;
+			}
+			free(value);
+#else
+			const char* value = getenv("VK_PHYSICAL_DEVICE");
+			if (value != nullptr) {
+				selector = value;
+			}
+#endif
+		}
+
+		PhysicalDeviceContext best = {};
+		int64_t bestScore = -1;
+		uint32_t bestIndex = 0;
+		std::cout << "Physical devices:" << std::endl;
+		for (uint32_t i = 0; i < deviceCount; i++) {
+			PhysicalDeviceContext ctx;
+			std::string rejection;
+			bool suitable = inspect(devices[i], surface, requiredExtensions, ctx, rejection);
+			std::cout << "\t[" << i << "] " << ctx.properties.deviceName << " (" << deviceTypeName(ctx.properties.deviceType) << "): ";
+			if (!suitable) {
+				std::cout << "rejected, " << rejection << std::endl;
+				continue;
+			}
+
+			std::string breakdown;
+			int64_t score = ctx.score(breakdown);
+			std::cout << "score " << score << " (" << breakdown << ")" << std::endl;
+			bool eligible = selector.empty() || matchesSelector(selector, i, ctx.properties.deviceName);
+			if (eligible && score > bestScore) {
+				best = ctx;
+				bestScore = score;
+				bestIndex = i;
+			}
+		}
+
+		if (bestScore < 0) {
+			throw std::runtime_error(selector.empty() ? "failed to find a suitable GPU!" : "no suitable GPU matches \"" + selector + "\"!");
+		}
+		std::cout << "Selected [" << bestIndex << "] " << best.properties.deviceName << " "
+			<< (selector.empty() ? "with the highest score" : "by selector \"" + selector + "\"")
+			<< "; queue families graphics " << best.queueFamilyIndices.graphics << ", present " << best.queueFamilyIndices.present
+			<< ", transfer " << best.queueFamilyIndices.transfer << ", compute " << best.queueFamilyIndices.compute << std::endl;
+		return best;
+	}
+};
+
+// Implements VkAllocationCallbacks so driver host memory comes from our own pools and can be measured. Every
+// VkSystemAllocationScope has its own arena, which keeps short-lived command allocations from interleaving with
+// object and device lifetimes. Small requests are carved out of 64 KiB chunks in power-of-two size classes and recycled
+// through free lists; each class is split into shards picked per thread, so the job and pipeline compiler threads
+// rarely take the same lock. Anything larger than the biggest class goes straight to the heap.
+struct HostAllocator {
+	static const uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+	static const uint32_t CLASS_COUNT = 8;
+	static const uint32_t SHARD_COUNT = 4;
+	static const size_t MIN_CLASS_SIZE = 32;
+	static const size_t CHUNK_SIZE = 64 * 1024;
+	static const size_t HEADER_SIZE = 32;
+	static const size_t BASE_ALIGNMENT = 16;
+	// All std::malloc promises, e.g. only 8 bytes on 32-bit Windows; chunks, slots and heap blocks start this aligned.
+	static const size_t MALLOC_ALIGNMENT = alignof(std::max_align_t);
+	static const uint16_t HEAP_CLASS = 0xffff;
+
+	// Stored immediately before every pointer handed to the driver.
+	struct Header {
+		char* base;
+		size_t size;
+		uint16_t sizeClass;
+		uint16_t shard;
+		uint32_t scope;
+	};
+
+	struct Shard {
+		std::mutex mutex;
+		char* freeList;
+		char* bump;
+		char* bumpEnd;
+		std::vector<char*> chunks;
+	};
+
+	struct Arena {
+		Shard shards[CLASS_COUNT][SHARD_COUNT];
+		std::atomic<int64_t> liveBytes;
+		std::atomic<int64_t> peakBytes;
+		std::atomic<int64_t> liveCount;
+		std::atomic<uint64_t> allocations;
+		// Chunk and oversized allocations that reached the heap.
+		std::atomic<uint64_t> heapAllocations;
+		// Reported by the driver for memory it allocated itself, such as executable code.
+		std::atomic<int64_t> internalBytes;
+		uint64_t measuredAllocations;
+		uint64_t measuredHeapAllocations;
+	};
+
+	VkAllocationCallbacks callbacks;
+	Arena arenas[SCOPE_COUNT];
+	std::atomic<uint32_t> nextShard;
+
+	static const char* scopeName(uint32_t scope) {
+		switch (scope) {
+		case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return "command";
+		case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return "object";
+		case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return "cache";
+		case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return "device";
+		default: return "instance";
+		}
+	}
+
+	void start() {
+		callbacks = {};
+		callbacks.pUserData = this;
+		callbacks.pfnAllocation = allocationFunction;
+		callbacks.pfnReallocation = reallocationFunction;
+		callbacks.pfnFree = freeFunction;
+		callbacks.pfnInternalAllocation = internalAllocationNotification;
+		callbacks.pfnInternalFree = internalFreeNotification;
+		nextShard = 0;
+		for (auto& arena : arenas) {
+			for (auto& shards : arena.shards) {
+				for (auto& shard : shards) {
+					shard.freeList = nullptr;
+					shard.bump = nullptr;
+					shard.bumpEnd = nullptr;
+				}
+			}
+			arena.liveBytes = 0;
+			arena.peakBytes = 0;
+			arena.liveCount = 0;
+			arena.allocations = 0;
+			arena.heapAllocations = 0;
+			arena.internalBytes = 0;
+			arena.measuredAllocations = 0;
+			arena.measuredHeapAllocations = 0;
+		}
+	}
+
+	// Must only run once every object created with these callbacks is gone.
+	void destroy() {
+		for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++) {
+			Arena& arena = arenas[scope];
+			if (arena.liveCount > 0) {
+				std::cerr << "host allocator destroyed with " << arena.liveCount << " live " << scopeName(scope) << " allocations ("
+					<< arena.liveBytes << " bytes)" << std::endl;
+			}
+			for (auto& shards : arena.shards) {
+				for (auto& shard : shards) {
+					for (char* chunk : shard.chunks) {
+						std::free(chunk);
+					}
+					shard.chunks.clear();
+					shard.freeList = nullptr;
+					shard.bump = nullptr;
+					shard.bumpEnd = nullptr;
 				}
 			}
 		}
+	}
+
+	// Restarts the per-frame allocation counts, e.g. once the frame loop has warmed up.
+	void resetMeasurements() {
+		for (auto& arena : arenas) {
+			arena.measuredAllocations = arena.allocations;
+			arena.measuredHeapAllocations = arena.heapAllocations;
+		}
+	}
+
+	static VKAPI_ATTR void* VKAPI_CALL allocationFunction(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+		return static_cast<HostAllocator*>(userData)->allocate(size, alignment, scope);
+	}
+
+	static VKAPI_ATTR void* VKAPI_CALL reallocationFunction(void* userData, void* original, size_t size, size_t alignment,
+		VkSystemAllocationScope scope) {
+		return static_cast<HostAllocator*>(userData)->reallocate(original, size, alignment, scope);
+	}
+
+	static VKAPI_ATTR void VKAPI_CALL freeFunction(void* userData, void* memory) {
+		static_cast<HostAllocator*>(userData)->free(memory);
+	}
+
+	static VKAPI_ATTR void VKAPI_CALL internalAllocationNotification(void* userData, size_t size, VkInternalAllocationType type,
+		VkSystemAllocationScope scope) {
+		static_cast<HostAllocator*>(userData)->arenas[scope].internalBytes += int64_t(size);
+	}
+
+	static VKAPI_ATTR void VKAPI_CALL internalFreeNotification(void* userData, size_t size, VkInternalAllocationType type,
+		VkSystemAllocationScope scope) {
+		static_cast<HostAllocator*>(userData)->arenas[scope].internalBytes -= int64_t(size);
+	}
+
+	// Threads are spread over the shards in the order they first allocate.
+	uint32_t threadShard() {
+		static thread_local uint32_t shard = SHARD_COUNT;
+		if (shard == SHARD_COUNT) {
+			shard = nextShard++ % SHARD_COUNT;
+		}
+		return shard;
+	}
+
+	// The block has room for the header plus enough slack to align the returned pointer, given that the block itself is
+	// only MALLOC_ALIGNMENT aligned.
+	static size_t blockSize(size_t size, size_t alignment) {
+		alignment = std::max(alignment, size_t(BASE_ALIGNMENT));
+		return size + HEADER_SIZE + (alignment > MALLOC_ALIGNMENT ? alignment - MALLOC_ALIGNMENT : 0);
+	}
+
+	static uint16_t classForSize(size_t size) {
+		for (uint16_t sizeClass = 0; sizeClass < CLASS_COUNT; sizeClass++) {
+			if ((MIN_CLASS_SIZE << sizeClass) >= size) {
+				return sizeClass;
+			}
+		}
+		return HEAP_CLASS;
+	}
+
+	static void track(Arena& arena, int64_t bytes) {
+		int64_t live = arena.liveBytes.fetch_add(bytes) + bytes;
+		int64_t peak = arena.peakBytes.load();
+		while (live > peak && !arena.peakBytes.compare_exchange_weak(peak, live)) {
+		}
+	}
+
+	char* takeSlot(Arena& arena, uint16_t sizeClass, uint32_t shardIndex) {
+		Shard& shard = arena.shards[sizeClass][shardIndex];
+		size_t slotSize = MIN_CLASS_SIZE << sizeClass;
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (shard.freeList != nullptr) {
+			char* slot = shard.freeList;
+			shard.freeList = *reinterpret_cast<char**>(slot);
+			return slot;
+		}
+		if (size_t(shard.bumpEnd - shard.bump) < slotSize) {
+			char* chunk = static_cast<char*>(std::malloc(CHUNK_SIZE));
+			if (chunk == nullptr) {
+				return nullptr;
+			}
+			arena.heapAllocations++;
+			shard.chunks.push_back(chunk);
+			shard.bump = chunk;
+			shard.bumpEnd = chunk + CHUNK_SIZE;
+		}
+		char* slot = shard.bump;
+		shard.bump += slotSize;
+		return slot;
+	}
+
+	void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+		Arena& arena = arenas[scope];
+		size_t required = blockSize(size, alignment);
+		uint16_t sizeClass = classForSize(required);
+		uint32_t shard = 0;
+		char* base;
+		if (sizeClass == HEAP_CLASS) {
+			base = static_cast<char*>(std::malloc(required));
+			arena.heapAllocations++;
+		}
+		else {
+			shard = threadShard();
+			base = takeSlot(arena, sizeClass, shard);
+		}
+		if (base == nullptr) {
+			return nullptr;
+		}
+
+		alignment = std::max(alignment, size_t(BASE_ALIGNMENT));
+		uintptr_t address = (reinterpret_cast<uintptr_t>(base) + HEADER_SIZE + alignment - 1) & ~uintptr_t(alignment - 1);
+		Header* header = reinterpret_cast<Header*>(address) - 1;
+		header->base = base;
+		header->size = size;
+		header->sizeClass = sizeClass;
+		header->shard = static_cast<uint16_t>(shard);
+		header->scope = scope;
+		track(arena, int64_t(size));
+		arena.liveCount++;
+		arena.allocations++;
+		return reinterpret_cast<void*>(address);
+	}
+
+	void free(void* memory) {
+		if (memory == nullptr) {
+			return;
+		}
+		Header* header = static_cast<Header*>(memory) - 1;
+		Arena& arena = arenas[header->scope];
+		track(arena, -int64_t(header->size));
+		arena.liveCount--;
+		if (header->sizeClass == HEAP_CLASS) {
+			std::free(header->base);
+			return;
+		}
+		Shard& shard = arena.shards[header->sizeClass][header->shard];
+		char* slot = header->base;
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		*reinterpret_cast<char**>(slot) = shard.freeList;
+		shard.freeList = slot;
+	}
+
+	// Grows or shrinks in place while the block still fits, otherwise moves. On failure the original stays valid.
+	void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+		if (original == nullptr) {
+			return allocate(size, alignment, scope);
+		}
+		if (size == 0) {
+			free(original);
+			return nullptr;
+		}
+		Header* header = static_cast<Header*>(original) - 1;
+		char* end = static_cast<char*>(original) + size;
+		if (header->scope == uint32_t(scope) && header->sizeClass != HEAP_CLASS && reinterpret_cast<uintptr_t>(original) % alignment == 0 &&
+			end <= header->base + (MIN_CLASS_SIZE << header->sizeClass)) {
+			track(arenas[scope], int64_t(size) - int64_t(header->size));
+			header->size = size;
+			return original;
+		}
+		void* memory = allocate(size, alignment, scope);
+		if (memory == nullptr) {
+			return nullptr;
+		}
+		memcpy(memory, original, std::min(size, header->size));
+		free(original);
+		return memory;
+	}
 
-		throw std::runtime_error("failed to find a suitable GPU!");
+	void printSummary(uint64_t frames) const {
+		std::cout << "Host allocations by scope:" << std::endl;
+		for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++) {
+			const Arena& arena = arenas[scope];
+			if (arena.allocations == 0 && arena.internalBytes == 0) {
+				continue;
+			}
+			uint64_t measured = arena.allocations - arena.measuredAllocations;
+			uint64_t measuredHeap = arena.heapAllocations - arena.measuredHeapAllocations;
+			std::cout << "\t" << std::left << std::setw(9) << scopeName(scope) << std::right << arena.liveCount << " live ("
+				<< arena.liveBytes / 1024 << " KiB, peak " << arena.peakBytes / 1024 << " KiB), " << arena.allocations
+				<< " allocations, " << arena.heapAllocations << " from the heap";
+			if (arena.internalBytes != 0) {
+				std::cout << ", " << arena.internalBytes / 1024 << " KiB internal";
+			}
+			if (frames > 0) {
+				std::cout << "; " << double(measured) / frames << " allocations and " << double(measuredHeap) / frames << " heap allocations per frame";
+			}
+			std::cout << std::endl;
+		}
 	}
 };
 
@@ -147,14 +832,17 @@ struct LogicalDeviceContext {
 	VkDevice device;
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	VkQueue transferQueue;
+	VkQueue computeQueue;
 
 	void destroy(VkAllocationCallbacks* allocator) {
 		vkDestroyDevice(device, allocator);
 	}
 	
-	static LogicalDeviceContext create(PhysicalDeviceContext physicalDeviceCtx) {
+	static LogicalDeviceContext create(PhysicalDeviceContext physicalDeviceCtx, VkAllocationCallbacks* allocator) {
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-		std::set<int> uniqueQueueFamilies = { physicalDeviceCtx.queueFamilyIndices.graphics, physicalDeviceCtx.queueFamilyIndices.present };
+		std::set<int> uniqueQueueFamilies = { physicalDeviceCtx.queueFamilyIndices.graphics, physicalDeviceCtx.queueFamilyIndices.present,
+			physicalDeviceCtx.queueFamilyIndices.transfer, physicalDeviceCtx.queueFamilyIndices.compute };
 
 		float queuePriority = 1.0f;
 		for (int queueFamily : uniqueQueueFamilies) {
@@ -167,13 +855,18 @@ struct LogicalDeviceContext {
 		}
 
 		VkPhysicalDeviceFeatures deviceFeatures = {};
+		deviceFeatures.pipelineStatisticsQuery = physicalDeviceCtx.features.pipelineStatisticsQuery;
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		timelineFeatures.timelineSemaphore = VK_TRUE;
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &timelineFeatures;
 		createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.pEnabledFeatures = &deviceFeatures;
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(physicalDeviceCtx.extensions.size());
+		createInfo.ppEnabledExtensionNames = physicalDeviceCtx.extensions.data();
 		if (enableValidationLayers) {
 			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
 			createInfo.ppEnabledLayerNames = validationLayers.data();
@@ -183,712 +876,6721 @@ struct LogicalDeviceContext {
 		}
 
 		LogicalDeviceContext ctx;
-		if (vkCreateDevice(physicalDeviceCtx.physicalDevice, &createInfo, nullptr, &ctx.device) != VK_SUCCESS) {
+		if (vkCreateDevice(physicalDeviceCtx.physicalDevice, &createInfo, allocator, &ctx.device) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create logical device!");
 		}
 		vkGetDeviceQueue(ctx.device, physicalDeviceCtx.queueFamilyIndices.graphics, 0, &ctx.graphicsQueue);
 		vkGetDeviceQueue(ctx.device, physicalDeviceCtx.queueFamilyIndices.present, 0, &ctx.presentQueue);
+		vkGetDeviceQueue(ctx.device, physicalDeviceCtx.queueFamilyIndices.transfer, 0, &ctx.transferQueue);
+		vkGetDeviceQueue(ctx.device, physicalDeviceCtx.queueFamilyIndices.compute, 0, &ctx.computeQueue);
 		return ctx;
 	}
 };
 
-struct SwapChainContext {
-	VkSwapchainKHR chain;
-	VkExtent2D extent;
-	VkSurfaceFormatKHR surfaceFormat;
-	std::vector<VkImage> images;
-	std::vector<VkImageView> imageViews;
+// Orders GPU work with one timeline semaphore per queue instead of fences and per-submission binary semaphores. Every
+// submission signals the next value of its queue's timeline, so a SyncPoint names it for the rest of the run: the CPU
+// waits for it with vkWaitSemaphores and other queues wait for it as a semaphore value. Submissions are held per queue
+// and handed to the driver in one vkQueueSubmit per queue when the scheduler is flushed. Roles that were given the
+// same VkQueue share a timeline. Submissions are expected to come from one thread at a time.
+struct SubmissionScheduler {
+	enum QueueRole {
+		QUEUE_GRAPHICS,
+		QUEUE_TRANSFER,
+		QUEUE_COMPUTE,
+		QUEUE_ROLE_COUNT
+	};
 
-	void destroy(VkDevice device, VkAllocationCallbacks* allocator) {
-		for (size_t i = 0; i < imageViews.size(); i++) {
-			vkDestroyImageView(device, imageViews[i], allocator);
-		}
-		vkDestroySwapchainKHR(device, chain, allocator);
-	}
+	// A value of 0 names no submission and is always complete.
+	struct SyncPoint {
+		uint32_t timeline;
+		uint64_t value;
+	};
 
-	static VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
-		if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED) {
-			return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
-		}
+	// A binary semaphore has a value of 0; swapchain acquire and present still need those.
+	struct Dependency {
+		VkSemaphore semaphore;
+		uint64_t value;
+		VkPipelineStageFlags stage;
+	};
 
-		for (const auto& availableFormat : availableFormats) {
-			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-				return availableFormat;
-			}
-		}
+	struct Timeline {
+		VkQueue queue;
+		VkSemaphore semaphore;
+		uint64_t nextValue;
+		uint64_t submittedValue;
+		// Last value read back from the semaphore.
+		uint64_t completedValue;
+	};
 
-		return availableFormats[0];
-	}
+	// The vectors own the arrays the VkSubmitInfo built at flush time points into.
+	struct PendingSubmit {
+		std::vector<VkCommandBuffer> commandBuffers;
+		std::vector<VkSemaphore> waitSemaphores;
+		std::vector<uint64_t> waitValues;
+		std::vector<VkPipelineStageFlags> waitStages;
+		std::vector<VkSemaphore> signalSemaphores;
+		std::vector<uint64_t> signalValues;
+		VkTimelineSemaphoreSubmitInfo timelineInfo;
+	};
+
+	VkDevice device;
+	VkAllocationCallbacks* allocator;
+	PFN_vkWaitSemaphoresKHR waitSemaphores;
+	PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue;
+	std::vector<Timeline> timelines;
+	std::vector<std::vector<PendingSubmit>> pending;
+	uint32_t roleTimelines[QUEUE_ROLE_COUNT];
+	uint64_t submissions;
+	uint64_t submitCalls;
 
-	static VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes) {
-		VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
+	static SubmissionScheduler create(const LogicalDeviceContext& logicalDeviceCtx, const PhysicalDeviceContext& physicalDeviceCtx,
+		VkAllocationCallbacks* allocator) {
+		SubmissionScheduler scheduler = {};
+		scheduler.device = logicalDeviceCtx.device;
+		scheduler.allocator = allocator;
+		bool extension = physicalDeviceCtx.timelineSemaphoreExtension != nullptr;
+		scheduler.waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(scheduler.device,
+			extension ? "vkWaitSemaphoresKHR" : "vkWaitSemaphores");
+		scheduler.getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(scheduler.device,
+			extension ? "vkGetSemaphoreCounterValueKHR" : "vkGetSemaphoreCounterValue");
+		if (scheduler.waitSemaphores == nullptr || scheduler.getSemaphoreCounterValue == nullptr) {
+			throw std::runtime_error("failed to load timeline semaphore functions!");
+		}
 
-		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-				return availablePresentMode;
+		VkQueue queues[QUEUE_ROLE_COUNT] = { logicalDeviceCtx.graphicsQueue, logicalDeviceCtx.transferQueue, logicalDeviceCtx.computeQueue };
+		for (uint32_t role = 0; role < QUEUE_ROLE_COUNT; role++) {
+			uint32_t index = 0;
+			while (index < scheduler.timelines.size() && scheduler.timelines[index].queue != queues[role]) {
+				index++;
 			}
-			else if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-				bestMode = availablePresentMode;
+			if (index == scheduler.timelines.size()) {
+				VkSemaphoreTypeCreateInfo typeInfo = {};
+				typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+				typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+				typeInfo.initialValue = 0;
+				VkSemaphoreCreateInfo semaphoreInfo = {};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				semaphoreInfo.pNext = &typeInfo;
+
+				Timeline timeline = {};
+				timeline.queue = queues[role];
+				timeline.nextValue = 1;
+				if (vkCreateSemaphore(scheduler.device, &semaphoreInfo, allocator, &timeline.semaphore) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create timeline semaphore!");
+				}
+				scheduler.timelines.push_back(timeline);
 			}
+			scheduler.roleTimelines[role] = index;
 		}
-
-		return bestMode;
+		scheduler.pending.resize(scheduler.timelines.size());
+		return scheduler;
 	}
 
-	static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
-		if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
-			return capabilities.currentExtent;
+	void destroy() {
+		for (const auto& timeline : timelines) {
+			vkDestroySemaphore(device, timeline.semaphore, allocator);
 		}
-		else {
-			VkExtent2D actualExtent = { WIDTH, HEIGHT };
+		timelines.clear();
+	}
 
-			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+	VkSemaphore semaphore(QueueRole role) const {
+		return timelines[roleTimelines[role]].semaphore;
+	}
 
-			return actualExtent;
+	Dependency after(SyncPoint point, VkPipelineStageFlags stage) const {
+		if (point.value == 0) {
+			return { VK_NULL_HANDLE, 0, stage };
 		}
+		return { timelines[point.timeline].semaphore, point.value, stage };
 	}
 
-	static SwapChainContext create(VkSurfaceKHR surface, VkDevice device, PhysicalDeviceContext physicalDeviceCtx) {
-		SwapChainContext ctx = {};
-		VkSurfaceCapabilitiesKHR capabilities;
-		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDeviceCtx.physicalDevice, surface, &capabilities);
-		VkPresentModeKHR presentMode = chooseSwapPresentMode(physicalDeviceCtx.swapChainCapabilities.presentModes);
-		ctx.surfaceFormat = chooseSwapSurfaceFormat(physicalDeviceCtx.swapChainCapabilities.formats);
-		ctx.extent = chooseSwapExtent(capabilities);
+	static Dependency afterBinary(VkSemaphore semaphore, VkPipelineStageFlags stage) {
+		return { semaphore, 0, stage };
+	}
+
+	// The point the next submission on a role will signal, for work recorded ahead of its submit.
+	SyncPoint nextPoint(QueueRole role) const {
+		uint32_t index = roleTimelines[role];
+		return { index, timelines[index].nextValue };
+	}
 
-		uint32_t imageCount = capabilities.minImageCount + 1;
-		if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
-			imageCount = capabilities.maxImageCount;
+	// Queues a submission that waits for the dependencies and signals the returned point along with any binary
+	// semaphores. Nothing reaches the driver until flush.
+	SyncPoint submit(QueueRole role, const std::vector<VkCommandBuffer>& commandBuffers, const std::vector<Dependency>& waits,
+		const std::vector<VkSemaphore>& binarySignals = {}) {
+		uint32_t index = roleTimelines[role];
+		Timeline& timeline = timelines[index];
+		PendingSubmit submission;
+		submission.commandBuffers = commandBuffers;
+		for (const auto& wait : waits) {
+			if (wait.semaphore == VK_NULL_HANDLE) {
+				continue;
+			}
+			submission.waitSemaphores.push_back(wait.semaphore);
+			submission.waitValues.push_back(wait.value);
+			submission.waitStages.push_back(wait.stage);
 		}
+		submission.signalSemaphores = binarySignals;
+		submission.signalValues.assign(binarySignals.size(), 0);
+		submission.signalSemaphores.push_back(timeline.semaphore);
+		submission.signalValues.push_back(timeline.nextValue);
+		pending[index].push_back(submission);
+		submissions++;
+		return { index, timeline.nextValue++ };
+	}
 
-		VkSwapchainCreateInfoKHR createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		createInfo.surface = surface;
-		createInfo.minImageCount = imageCount;
-		createInfo.imageFormat = ctx.surfaceFormat.format;
-		createInfo.imageColorSpace = ctx.surfaceFormat.colorSpace;
-		createInfo.imageExtent = ctx.extent;
-		createInfo.imageArrayLayers = 1;
-		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-		createInfo.preTransform = capabilities.currentTransform;
-		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-		createInfo.presentMode = presentMode;
-		createInfo.clipped = VK_TRUE;
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// Timelines allow a wait to be submitted before its signal, so the queues can be flushed in any order.
+	void flush() {
+		for (uint32_t index = 0; index < timelines.size(); index++) {
+			std::vector<PendingSubmit>& batch = pending[index];
+			if (batch.empty()) {
+				continue;
+			}
+			std::vector<VkSubmitInfo> submitInfos(batch.size());
+			for (size_t i = 0; i < batch.size(); i++) {
+				PendingSubmit& submission = batch[i];
+				submission.timelineInfo = {};
+				submission.timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+				submission.timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(submission.waitValues.size());
+				submission.timelineInfo.pWaitSemaphoreValues = submission.waitValues.data();
+				submission.timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(submission.signalValues.size());
+				submission.timelineInfo.pSignalSemaphoreValues = submission.signalValues.data();
 
-		uint32_t queueFamilyIndices[] = { (uint32_t)physicalDeviceCtx.queueFamilyIndices.graphics, (uint32_t)physicalDeviceCtx.queueFamilyIndices.present };
+				VkSubmitInfo& submitInfo = submitInfos[i];
+				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				submitInfo.pNext = &submission.timelineInfo;
+				submitInfo.waitSemaphoreCount = static_cast<uint32_t>(submission.waitSemaphores.size());
+				submitInfo.pWaitSemaphores = submission.waitSemaphores.data();
+				submitInfo.pWaitDstStageMask = submission.waitStages.data();
+				submitInfo.commandBufferCount = static_cast<uint32_t>(submission.commandBuffers.size());
+				submitInfo.pCommandBuffers = submission.commandBuffers.data();
+				submitInfo.signalSemaphoreCount = static_cast<uint32_t>(submission.signalSemaphores.size());
+				submitInfo.pSignalSemaphores = submission.signalSemaphores.data();
+			}
+			if (vkQueueSubmit(timelines[index].queue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit command buffers!");
+			}
+			timelines[index].submittedValue = timelines[index].nextValue - 1;
+			submitCalls++;
+			batch.clear();
+		}
+	}
 
-		if (physicalDeviceCtx.queueFamilyIndices.graphics != physicalDeviceCtx.queueFamilyIndices.present) {
-			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-			createInfo.queueFamilyIndexCount = 2;
-			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+	bool isComplete(SyncPoint point) {
+		Timeline& timeline = timelines[point.timeline];
+		if (point.value <= timeline.completedValue) {
+			return true;
 		}
-		else {
-			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			createInfo.queueFamilyIndexCount = 0; // Optional
-			createInfo.pQueueFamilyIndices = nullptr; // Optional
+		if (point.value > timeline.submittedValue) {
+			return false;
 		}
+		getSemaphoreCounterValue(device, timeline.semaphore, &timeline.completedValue);
+		return point.value <= timeline.completedValue;
+	}
 
-		if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &ctx.chain) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create swap chain!");
+	// Blocks until the point has completed, flushing first if it is still held back.
+	void wait(SyncPoint point) {
+		if (isComplete(point)) {
+			return;
+		}
+		Timeline& timeline = timelines[point.timeline];
+		if (point.value > timeline.submittedValue) {
+			flush();
+		}
+		VkSemaphoreWaitInfo waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &timeline.semaphore;
+		waitInfo.pValues = &point.value;
+		if (waitSemaphores(device, &waitInfo, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to wait for timeline semaphore!");
 		}
+		timeline.completedValue = std::max(timeline.completedValue, point.value);
+	}
 
-		vkGetSwapchainImagesKHR(device, ctx.chain, &imageCount, nullptr);
-		ctx.images.resize(imageCount);
-		vkGetSwapchainImagesKHR(device, ctx.chain, &imageCount, ctx.images.data());
-
-		ctx.imageViews.resize(imageCount);
-		for (uint32_t i = 0; i < imageCount; i++) {
-			VkImageViewCreateInfo createInfo = {};
-			createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-			createInfo.image = ctx.images[i];
-			createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			createInfo.format = ctx.surfaceFormat.format;
-			createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-			createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-			createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-			createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-			createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			createInfo.subresourceRange.baseMipLevel = 0;
-			createInfo.subresourceRange.levelCount = 1;
-			createInfo.subresourceRange.baseArrayLayer = 0;
-			createInfo.subresourceRange.layerCount = 1;
-			if (vkCreateImageView(device, &createInfo, nullptr, &ctx.imageViews[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to create image views!");
-			}
-		}
-		return ctx;
+	void printSummary() const {
+		std::cout << "Submitted " << submissions << " batches in " << submitCalls << " vkQueueSubmit calls on " << timelines.size()
+			<< (timelines.size() == 1 ? " queue timeline" : " queue timelines") << std::endl;
 	}
 };
 
-class HelloTriangleApplication {
-public:
-	void run() {
-		window = initWindow();
-		initVulkan(window);
-		mainLoop();
-		cleanup();
-	}
+struct DeviceAllocation {
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	void* mapped;
+	uint32_t memoryType;
+	uint32_t poolIndex;
+	uint32_t blockIndex;
+	uint32_t order;
+	bool dedicated;
+};
 
-private:
-	GLFWwindow* window;
-	VkInstance instance;
-	VkDebugReportCallbackEXT callback;
-	VkSurfaceKHR surface;
-	PhysicalDeviceContext physicalDeviceCtx;
-	LogicalDeviceContext logicalDeviceCtx;
-	SwapChainContext swapChainCtx;
-	VkRenderPass renderPass;
-	VkPipelineLayout pipelineLayout;
-	VkPipeline graphicsPipeline;
-	std::vector<VkFramebuffer> swapChainFramebuffers;
-	std::vector<VkCommandBuffer> commandBuffers;
-	VkCommandPool commandPool;
-	VkSemaphore imageAvailableSemaphore;
-	VkSemaphore renderFinishedSemaphore;
+// Sub-allocates resources out of large VkDeviceMemory blocks, one set of blocks per memory type, using a buddy allocator.
+// Buddy ranges are naturally aligned to their size, which covers any power-of-two alignment requirement. When
+// bufferImageGranularity is coarser than the smallest buddy, optimal-tiling images get their own blocks so they never
+// share a granularity page with buffers. Requests larger than half a block get a dedicated allocation.
+struct DeviceMemoryAllocator {
+	static const VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+	static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+	static const VkDeviceSize MIN_BLOCK_SIZE = 1024 * 1024;
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugReportFlagsEXT flags,
-		VkDebugReportObjectTypeEXT objType,
-		uint64_t obj,
-		size_t location,
-		int32_t code,
-		const char* layerPrefix,
-		const char* msg,
-		void* userData) {
+	struct Block {
+		VkDeviceMemory memory;
+		void* mapped;
+		uint32_t maxOrder;
+		std::vector<std::set<VkDeviceSize>> freeLists;
+		VkDeviceSize allocatedBytes;
+		VkDeviceSize requestedBytes;
+		uint32_t allocationCount;
+	};
 
-		std::cerr << "validation layer: " << msg << std::endl;
+	struct Pool {
+		uint32_t memoryType;
+		bool optimalImages;
+		VkDeviceSize blockSize;
+		std::vector<Block> blocks;
+	};
 
-		return VK_FALSE;
-	}
+	struct Stats {
+		uint32_t blockCount;
+		uint32_t allocationCount;
+		uint32_t dedicatedCount;
+		VkDeviceSize blockBytes;
+		VkDeviceSize allocatedBytes;
+		VkDeviceSize requestedBytes;
+		VkDeviceSize dedicatedBytes;
+		VkDeviceSize freeBytes;
+		VkDeviceSize largestFreeRange;
+	};
+
+	VkDevice device;
+	VkAllocationCallbacks* allocator;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	bool separateImagePools;
+	uint32_t maxMemoryAllocationCount;
+	uint32_t memoryAllocationCount;
+	uint32_t dedicatedCount;
+	VkDeviceSize dedicatedBytes;
+	std::vector<Pool> pools;
 
-	static VkResult CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback) {
-		auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-		if (func != nullptr) {
-			return func(instance, pCreateInfo, pAllocator, pCallback);
-		} else {
-			return VK_ERROR_EXTENSION_NOT_PRESENT;
+	static DeviceMemoryAllocator create(VkDevice device, VkAllocationCallbacks* allocator, const PhysicalDeviceContext& physicalDeviceCtx) {
+		DeviceMemoryAllocator ctx = {};
+		ctx.device = device;
+		ctx.allocator = allocator;
+		ctx.memoryProperties = physicalDeviceCtx.memoryProperties;
+		ctx.separateImagePools = physicalDeviceCtx.properties.limits.bufferImageGranularity > MIN_ALLOCATION_SIZE;
+		ctx.maxMemoryAllocationCount = physicalDeviceCtx.properties.limits.maxMemoryAllocationCount;
+		ctx.pools.resize(ctx.memoryProperties.memoryTypeCount * 2);
+		for (uint32_t i = 0; i < ctx.pools.size(); i++) {
+			Pool& pool = ctx.pools[i];
+			pool.memoryType = i / 2;
+			pool.optimalImages = (i % 2) == 1;
+			VkDeviceSize heapSize = ctx.memoryProperties.memoryHeaps[ctx.memoryProperties.memoryTypes[pool.memoryType].heapIndex].size;
+			pool.blockSize = DEFAULT_BLOCK_SIZE;
+			while (pool.blockSize > MIN_BLOCK_SIZE && pool.blockSize > heapSize / 8) {
+				pool.blockSize /= 2;
+			}
 		}
+		return ctx;
 	}
-	
-	static VkResult DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks* pAllocator) {
-		auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
-		if (func != nullptr) {
-			func(instance, callback, pAllocator);
-			return VK_SUCCESS;
-		} else {
-			return VK_ERROR_EXTENSION_NOT_PRESENT;
+
+	void destroy() {
+		for (auto& pool : pools) {
+			for (auto& block : pool.blocks) {
+				if (block.memory == VK_NULL_HANDLE) {
+					continue;
+				}
+				if (block.allocationCount > 0) {
+					std::cerr << "device memory block destroyed with " << block.allocationCount << " live allocations" << std::endl;
+				}
+				vkFreeMemory(device, block.memory, allocator);
+			}
+			pool.blocks.clear();
 		}
 	}
 
-	static VkDebugReportCallbackEXT createDebugCallback(VkInstance instance) {
-		if (!enableValidationLayers) return NULL;
-		VkDebugReportCallbackCreateInfoEXT createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-		createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_INFORMATION_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT | VK_DEBUG_REPORT_DEBUG_BIT_EXT;
-		createInfo.pfnCallback = debugCallback;
-		VkDebugReportCallbackEXT callback;
-		if (CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, &callback) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to set up debug callback!");
+	// Picks the type that has every required flag and the most preferred ones, favoring types without extra flags.
+	uint32_t chooseMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const {
+		int bestScore = -1;
+		uint32_t bestType = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+			if (!(typeBits & (1 << i)) || (flags & required) != required) {
+				continue;
+			}
+			int score = 0;
+			for (uint32_t bit = 0; bit < 32; bit++) {
+				VkMemoryPropertyFlags mask = 1u << bit;
+				if (preferred & mask) {
+					score += (flags & mask) ? 4 : 0;
+				}
+				else if (!(required & mask) && (flags & mask)) {
+					score -= 1;
+				}
+			}
+			score += 64;
+			if (score > bestScore) {
+				bestScore = score;
+				bestType = i;
+			}
+		}
+		if (bestScore < 0) {
+			throw std::runtime_error("failed to find suitable memory type!");
 		}
-		return callback;
+		return bestType;
 	}
 
-	static std::vector<const char*> getRequiredExtensions() {
-		unsigned int glfwExtensionCount = 0;
-		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-		if (enableValidationLayers) {
-			extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	static uint32_t orderForSize(VkDeviceSize size) {
+		uint32_t order = 0;
+		while ((MIN_ALLOCATION_SIZE << order) < size) {
+			order++;
 		}
-		return extensions;
+		return order;
 	}
 
-	static void checkValidationLayerSupport() {
-		uint32_t layerCount;
-		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-		std::vector<VkLayerProperties> availableLayers(layerCount);
-		vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
-
-		std::cout << "Available validation layers:" << std::endl;
-		for (const auto& layer : availableLayers) {
-			std::cout << "\t" << layer.layerName << std::endl;
+	VkDeviceMemory allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, void** mapped) {
+		if (memoryAllocationCount >= maxMemoryAllocationCount) {
+			throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+		}
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(device, &allocInfo, allocator, &memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate device memory!");
 		}
+		memoryAllocationCount++;
 
-		std::vector<const char*> requestedLayers(validationLayers);
-		auto presentLayers = std::remove_if(requestedLayers.begin(), requestedLayers.end(), [&](const char* layer) {
-			auto result = std::find_if(availableLayers.begin(), availableLayers.end(), [&](VkLayerProperties props) {
-				return strcmp(layer, props.layerName) == 0;
-			});
-			return result != availableLayers.end();
-		});
-		requestedLayers.erase(presentLayers, requestedLayers.end());
-		
-		if (!requestedLayers.empty()) {
-			throw std::runtime_error("validation layers requested, but not available!");
+		*mapped = nullptr;
+		if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+			if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+				throw std::runtime_error("failed to map device memory!");
+			}
 		}
+		return memory;
 	}
 
-	static VkSurfaceKHR createSurface(VkInstance instance, GLFWwindow* window) {
-		VkSurfaceKHR surface;
-		if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create window surface!");
+	void freeDeviceMemory(VkDeviceMemory memory) {
+		vkFreeMemory(device, memory, allocator);
+		memoryAllocationCount--;
+	}
+
+	static bool allocateFromBlock(Block& block, uint32_t order, VkDeviceSize& offset) {
+		uint32_t available = order;
+		while (available <= block.maxOrder && block.freeLists[available].empty()) {
+			available++;
 		}
-		return surface;
+		if (available > block.maxOrder) {
+			return false;
+		}
+		offset = *block.freeLists[available].begin();
+		block.freeLists[available].erase(block.freeLists[available].begin());
+		while (available > order) {
+			available--;
+			block.freeLists[available].insert(offset + (MIN_ALLOCATION_SIZE << available));
+		}
+		return true;
 	}
 
-	static VkInstance createInstance() {
-		if (enableValidationLayers) {
-			checkValidationLayerSupport();
+	static void freeToBlock(Block& block, VkDeviceSize offset, uint32_t order) {
+		while (order < block.maxOrder) {
+			VkDeviceSize buddy = offset ^ (MIN_ALLOCATION_SIZE << order);
+			auto it = block.freeLists[order].find(buddy);
+			if (it == block.freeLists[order].end()) {
+				break;
+			}
+			block.freeLists[order].erase(it);
+			offset = std::min(offset, buddy);
+			order++;
 		}
+		block.freeLists[order].insert(offset);
+	}
 
-		VkApplicationInfo appInfo = {};
-		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-		appInfo.pApplicationName = "Hello Triangle";
-		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.pEngineName = "No Engine";
-		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+	uint32_t createBlock(Pool& pool) {
+		uint32_t index = 0;
+		while (index < pool.blocks.size() && pool.blocks[index].memory != VK_NULL_HANDLE) {
+			index++;
+		}
+		if (index == pool.blocks.size()) {
+			pool.blocks.emplace_back();
+		}
+		Block& block = pool.blocks[index];
+		block.memory = allocateDeviceMemory(pool.memoryType, pool.blockSize, &block.mapped);
+		block.maxOrder = orderForSize(pool.blockSize);
+		block.freeLists.assign(block.maxOrder + 1, std::set<VkDeviceSize>());
+		block.freeLists[block.maxOrder].insert(0);
+		block.allocatedBytes = 0;
+		block.requestedBytes = 0;
+		block.allocationCount = 0;
+		return index;
+	}
 
-		uint32_t extensionCount = 0;
-		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-		std::vector<VkExtensionProperties> extensions(extensionCount);
-		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+	DeviceAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool optimalImage) {
+		DeviceAllocation allocation = {};
+		allocation.memoryType = chooseMemoryType(requirements.memoryTypeBits, required, preferred);
+		allocation.poolIndex = allocation.memoryType * 2 + ((optimalImage && separateImagePools) ? 1 : 0);
+		allocation.size = requirements.size;
+		Pool& pool = pools[allocation.poolIndex];
 
-		std::cout << "Available extensions:" << std::endl;
-		for (const auto& extension : extensions) {
-			std::cout << "\t" << extension.extensionName << std::endl;
+		VkDeviceSize needed = std::max(std::max(requirements.size, requirements.alignment), VkDeviceSize(MIN_ALLOCATION_SIZE));
+		if (needed > pool.blockSize / 2) {
+			allocation.dedicated = true;
+			allocation.offset = 0;
+			allocation.memory = allocateDeviceMemory(allocation.memoryType, requirements.size, &allocation.mapped);
+			dedicatedCount++;
+			dedicatedBytes += requirements.size;
+			return allocation;
 		}
 
-		auto requiredExtensions = getRequiredExtensions();
-		std::vector<const char*> requestedExtensions(requiredExtensions);
-		auto presentExtensions = std::remove_if(requestedExtensions.begin(), requestedExtensions.end(), [&](const char* ext) {
-			auto result = std::find_if(extensions.begin(), extensions.end(), [&](VkExtensionProperties props) {
-				return strcmp(ext, props.extensionName) == 0;
-			});
-			return result != extensions.end();
-		});
-		requestedExtensions.erase(presentExtensions, requestedExtensions.end());
-
-		if (!requestedExtensions.empty()) {
-			std::cout << "Some required extensions were missing: " << std::endl;
-			for (const auto& extension : requestedExtensions) {
-				std::cout << "\t" << extension << std::endl;
+		allocation.order = orderForSize(needed);
+		bool found = false;
+		for (uint32_t i = 0; i < pool.blocks.size() && !found; i++) {
+			if (pool.blocks[i].memory != VK_NULL_HANDLE && allocateFromBlock(pool.blocks[i], allocation.order, allocation.offset)) {
+				allocation.blockIndex = i;
+				found = true;
 			}
 		}
+		if (!found) {
+			allocation.blockIndex = createBlock(pool);
+			allocateFromBlock(pool.blocks[allocation.blockIndex], allocation.order, allocation.offset);
+		}
 
-		VkInstanceCreateInfo createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-		createInfo.pApplicationInfo = &appInfo;
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
-		createInfo.ppEnabledExtensionNames = requiredExtensions.data();
-		createInfo.enabledLayerCount = 0;
-		if (enableValidationLayers) {
-			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-			createInfo.ppEnabledLayerNames = validationLayers.data();
+		Block& block = pool.blocks[allocation.blockIndex];
+		block.allocatedBytes += MIN_ALLOCATION_SIZE << allocation.order;
+		block.requestedBytes += requirements.size;
+		block.allocationCount++;
+		allocation.memory = block.memory;
+		allocation.mapped = block.mapped != nullptr ? static_cast<char*>(block.mapped) + allocation.offset : nullptr;
+		return allocation;
+	}
+
+	void free(const DeviceAllocation& allocation) {
+		if (allocation.memory == VK_NULL_HANDLE) {
+			return;
 		}
-		else {
-			createInfo.enabledLayerCount = 0;
+		if (allocation.dedicated) {
+			freeDeviceMemory(allocation.memory);
+			dedicatedCount--;
+			dedicatedBytes -= allocation.size;
+			return;
 		}
 
-		VkInstance instance;
-		if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create instance!");
+		Pool& pool = pools[allocation.poolIndex];
+		Block& block = pool.blocks[allocation.blockIndex];
+		freeToBlock(block, allocation.offset, allocation.order);
+		block.allocatedBytes -= MIN_ALLOCATION_SIZE << allocation.order;
+		block.requestedBytes -= allocation.size;
+		block.allocationCount--;
+
+		// Keep one empty block per pool around so steady-state churn does not hit vkAllocateMemory.
+		if (block.allocationCount == 0) {
+			size_t liveBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(), [](const Block& b) { return b.memory != VK_NULL_HANDLE; });
+			if (liveBlocks > 1) {
+				freeDeviceMemory(block.memory);
+				block.memory = VK_NULL_HANDLE;
+				block.mapped = nullptr;
+			}
 		}
-		return instance;
 	}
 
-	VkShaderModule createShaderModule(VkDevice device, const std::string filename) {
-		auto code = readFile(filename);
-		VkShaderModuleCreateInfo createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-		VkShaderModule shaderModule;
-		if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create shader module!");
+	DeviceAllocation createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkBuffer& buffer) {
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create buffer!");
 		}
-		return shaderModule;
-	}
 
-	static GLFWwindow* initWindow() {
-		glfwInit();
-		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-		return glfwCreateWindow(800, 600, "Vulkan", nullptr, nullptr);
-	}
-
-	void initVulkan(GLFWwindow* window) {
-		instance = createInstance();
-		callback = createDebugCallback(instance);
-		surface = createSurface(instance, window);
-		physicalDeviceCtx = PhysicalDeviceContext::findBest(instance, surface);
-		logicalDeviceCtx = LogicalDeviceContext::create(physicalDeviceCtx);
-		swapChainCtx = SwapChainContext::create(surface, logicalDeviceCtx.device, physicalDeviceCtx);
-
-		auto vertShader = createShaderModule(logicalDeviceCtx.device, "shaders/vert.spv");
-		auto fragShader = createShaderModule(logicalDeviceCtx.device, "shaders/frag.spv");
-
-		pipelineLayout = createPipelineLayout(logicalDeviceCtx.device);
-		renderPass = createRenderPass(logicalDeviceCtx.device, swapChainCtx);
-		graphicsPipeline = createGraphicsPipeline(logicalDeviceCtx.device, swapChainCtx, renderPass, pipelineLayout, vertShader, fragShader);
-
-		vkDestroyShaderModule(logicalDeviceCtx.device, fragShader, nullptr);
-		vkDestroyShaderModule(logicalDeviceCtx.device, vertShader, nullptr);
-
-		commandPool = createCommandPool(logicalDeviceCtx.device, physicalDeviceCtx.queueFamilyIndices);
-		createFramebuffers();
-		createCommandBuffers();
-		imageAvailableSemaphore = createSemaphore(logicalDeviceCtx.device);
-		renderFinishedSemaphore = createSemaphore(logicalDeviceCtx.device);
-	}
-
-	static VkRenderPass createRenderPass(VkDevice device, SwapChainContext swapChainCtx) {
-		VkAttachmentDescription colorAttachment = {};
-		colorAttachment.format = swapChainCtx.surfaceFormat.format;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-		VkAttachmentReference colorAttachmentRef = {};
-		colorAttachmentRef.attachment = 0;
-		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &colorAttachmentRef;
-
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, buffer, &requirements);
+		DeviceAllocation allocation = allocate(requirements, required, preferred, false);
+		vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+		return allocation;
+	}
 
-		VkRenderPassCreateInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = 1;
-		renderPassInfo.pAttachments = &colorAttachment;
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+	void destroyBuffer(VkBuffer buffer, const DeviceAllocation& allocation) {
+		vkDestroyBuffer(device, buffer, allocator);
+		free(allocation);
+	}
 
-		VkRenderPass renderPass;
-		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create render pass!");
+	DeviceAllocation createImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkImage& image) {
+		if (vkCreateImage(device, &imageInfo, allocator, &image) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create image!");
 		}
-		return renderPass;
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, image, &requirements);
+		DeviceAllocation allocation = allocate(requirements, required, preferred, imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL);
+		vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+		return allocation;
 	}
 
-	static VkPipelineLayout createPipelineLayout(VkDevice device) {
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutInfo.setLayoutCount = 0; // Optional
-		pipelineLayoutInfo.pSetLayouts = nullptr; // Optional
-		pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-		pipelineLayoutInfo.pPushConstantRanges = 0; // Optional
+	void destroyImage(VkImage image, const DeviceAllocation& allocation) {
+		vkDestroyImage(device, image, allocator);
+		free(allocation);
+	}
 
-		VkPipelineLayout layout;
-		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create pipeline layout!");
+	Stats getStats(uint32_t memoryType) const {
+		Stats stats = {};
+		for (uint32_t p = memoryType * 2; p < memoryType * 2 + 2; p++) {
+			for (const auto& block : pools[p].blocks) {
+				if (block.memory == VK_NULL_HANDLE) {
+					continue;
+				}
+				stats.blockCount++;
+				stats.allocationCount += block.allocationCount;
+				stats.blockBytes += pools[p].blockSize;
+				stats.allocatedBytes += block.allocatedBytes;
+				stats.requestedBytes += block.requestedBytes;
+				for (uint32_t order = 0; order <= block.maxOrder; order++) {
+					VkDeviceSize rangeSize = MIN_ALLOCATION_SIZE << order;
+					stats.freeBytes += rangeSize * block.freeLists[order].size();
+					if (!block.freeLists[order].empty()) {
+						stats.largestFreeRange = std::max(stats.largestFreeRange, rangeSize);
+					}
+				}
+			}
 		}
-		return layout;
+		return stats;
 	}
 
-	static VkPipeline createGraphicsPipeline(VkDevice device, SwapChainContext swapChainCtx, VkRenderPass renderPass,
-		VkPipelineLayout pipelineLayout, VkShaderModule vertShader, VkShaderModule fragShader) {
-		VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfo.module = vertShader;
-		vertShaderStageInfo.pName = "main";
+	// Utilization is requested bytes over reserved block bytes; fragmentation is the share of free memory
+	// that is not part of the largest free range.
+	void printStats() const {
+		std::cout << "Device memory: " << memoryAllocationCount << " vkAllocateMemory allocations live (limit " << maxMemoryAllocationCount
+			<< "), " << dedicatedCount << " dedicated (" << dedicatedBytes / 1024 << " KiB)" << std::endl;
+		for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+			Stats stats = getStats(type);
+			if (stats.blockCount == 0) {
+				continue;
+			}
+			double utilization = stats.blockBytes > 0 ? 100.0 * stats.requestedBytes / stats.blockBytes : 0.0;
+			double fragmentation = stats.freeBytes > 0 ? 100.0 * (1.0 - double(stats.largestFreeRange) / stats.freeBytes) : 0.0;
+			std::cout << "\tmemory type " << type << ": " << stats.blockCount << " blocks, " << stats.allocationCount << " allocations, "
+				<< stats.requestedBytes / 1024 << " KiB used of " << stats.blockBytes / 1024 << " KiB (" << utilization
+				<< "% utilization, " << fragmentation << "% fragmentation)" << std::endl;
+		}
+	}
+};
 
-		VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfo.module = fragShader;
-		fragShaderStageInfo.pName = "main";
+// A persistently mapped, host-coherent buffer split into one region per frame in flight. Each frame bump-allocates
+// from its own region, which is recycled wholesale once that frame has completed.
+struct FrameRingBuffer {
+	VkBuffer buffer;
+	DeviceAllocation allocation;
+	VkDeviceSize frameSize;
+	VkDeviceSize frameOffset;
+	VkDeviceSize head;
+	VkDeviceSize highWater;
 
-		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+	void destroy(DeviceMemoryAllocator& memoryAllocator) {
+		memoryAllocator.destroyBuffer(buffer, allocation);
+	}
 
-		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertexInputInfo.vertexBindingDescriptionCount = 0;
-		vertexInputInfo.pVertexBindingDescriptions = nullptr; // Optional
-		vertexInputInfo.vertexAttributeDescriptionCount = 0;
-		vertexInputInfo.pVertexAttributeDescriptions = nullptr; // Optional
+	static FrameRingBuffer create(DeviceMemoryAllocator& memoryAllocator, VkBufferUsageFlags usage, VkDeviceSize frameSize, uint32_t framesInFlight) {
+		FrameRingBuffer ring = {};
+		ring.frameSize = frameSize;
+		ring.allocation = memoryAllocator.createBuffer(frameSize * framesInFlight, usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ring.buffer);
+		return ring;
+	}
 
-		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		inputAssembly.primitiveRestartEnable = VK_FALSE;
+	void beginFrame(uint32_t frameIndex) {
+		frameOffset = frameIndex * frameSize;
+		head = 0;
+	}
 
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)swapChainCtx.extent.width;
-		viewport.height = (float)swapChainCtx.extent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
+	// Returns the offset of the allocation within buffer, or VK_WHOLE_SIZE if this frame's region is exhausted.
+	VkDeviceSize allocate(VkDeviceSize size, VkDeviceSize alignment, void** data) {
+		VkDeviceSize aligned = (head + alignment - 1) / alignment * alignment;
+		if (aligned + size > frameSize) {
+			return VK_WHOLE_SIZE;
+		}
+		head = aligned + size;
+		highWater = std::max(highWater, head);
+		*data = static_cast<char*>(allocation.mapped) + frameOffset + aligned;
+		return frameOffset + aligned;
+	}
+};
 
-		VkRect2D scissor = {};
-		scissor.offset = { 0, 0 };
-		scissor.extent = swapChainCtx.extent;
+// Streams buffer uploads through a persistently mapped staging ring and submits them in batches on the transfer queue,
+// so large uploads never occupy the graphics queue. When the transfer family differs from the graphics family, each
+// batch releases ownership of the destination ranges and the graphics side records the matching acquire barriers.
+// Batches complete in order on the transfer timeline, so the next graphics submit only waits for the latest one.
+struct StagingRing {
+	static const uint32_t MAX_BATCHES = 4;
+	static const VkDeviceSize COPY_ALIGNMENT = 16;
 
-		VkPipelineViewportStateCreateInfo viewportState = {};
-		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewportState.viewportCount = 1;
-		viewportState.pViewports = &viewport;
-		viewportState.scissorCount = 1;
-		viewportState.pScissors = &scissor;
+	struct Batch {
+		VkCommandBuffer commandBuffer;
+		SubmissionScheduler::SyncPoint point;
+		VkDeviceSize ringEnd;
+		bool inFlight;
+	};
 
-		VkPipelineRasterizationStateCreateInfo rasterizer = {};
-		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterizer.depthClampEnable = VK_FALSE;
-		rasterizer.rasterizerDiscardEnable = VK_FALSE;
-		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-		rasterizer.lineWidth = 1.0f;
-		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-		rasterizer.depthBiasEnable = VK_FALSE;
-		rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-		rasterizer.depthBiasClamp = 0.0f; // Optional
-		rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+	struct PendingCopy {
+		VkBuffer dstBuffer;
+		VkBufferCopy region;
+		VkAccessFlags dstAccessMask;
+	};
 
-		VkPipelineMultisampleStateCreateInfo multisampling = {};
-		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisampling.minSampleShading = 1.0f; // Optional
-		multisampling.pSampleMask = nullptr; // Optional
-		multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-		multisampling.alphaToOneEnable = VK_FALSE; // Optional
+	VkDevice device;
+	VkAllocationCallbacks* allocator;
+	SubmissionScheduler* scheduler;
+	uint32_t transferFamily;
+	uint32_t graphicsFamily;
+	VkCommandPool commandPool;
+	VkBuffer buffer;
+	DeviceAllocation allocation;
+	VkDeviceSize size;
+	// Monotonic byte counters; the ring position is the counter modulo size.
+	VkDeviceSize head;
+	VkDeviceSize tail;
+	std::vector<Batch> batches;
+	uint32_t nextBatch;
+	std::vector<PendingCopy> pending;
+	std::vector<VkBufferMemoryBarrier> pendingAcquires;
+	// The last batch submitted since the graphics side last took its wait, or a point of value 0.
+	SubmissionScheduler::SyncPoint pendingWait;
+	VkDeviceSize bytesUploaded;
+	uint32_t batchesSubmitted;
+	uint32_t ringStalls;
 
-		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachment.blendEnable = VK_FALSE;
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+	static StagingRing create(const LogicalDeviceContext& logicalDeviceCtx, const QueueFamilyIndices& queueFamilyIndices,
+		DeviceMemoryAllocator& memoryAllocator, SubmissionScheduler& scheduler, VkAllocationCallbacks* allocator, VkDeviceSize size) {
+		StagingRing ring = {};
+		ring.device = logicalDeviceCtx.device;
+		ring.allocator = allocator;
+		ring.scheduler = &scheduler;
+		ring.transferFamily = queueFamilyIndices.transfer;
+		ring.graphicsFamily = queueFamilyIndices.graphics;
+		ring.size = size;
+		ring.allocation = memoryAllocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, ring.buffer);
 
-		VkPipelineColorBlendStateCreateInfo colorBlending = {};
-		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		colorBlending.logicOpEnable = VK_FALSE;
-		colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-		colorBlending.attachmentCount = 1;
-		colorBlending.pAttachments = &colorBlendAttachment;
-		colorBlending.blendConstants[0] = 0.0f; // Optional
-		colorBlending.blendConstants[1] = 0.0f; // Optional
-		colorBlending.blendConstants[2] = 0.0f; // Optional
-		colorBlending.blendConstants[3] = 0.0f; // Optional
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = ring.transferFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		if (vkCreateCommandPool(ring.device, &poolInfo, allocator, &ring.commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create transfer command pool!");
+		}
 
-		VkDynamicState dynamicStates[] = {
-			VK_DYNAMIC_STATE_VIEWPORT,
-			VK_DYNAMIC_STATE_LINE_WIDTH
-		};
+		ring.batches.resize(MAX_BATCHES);
+		for (auto& batch : ring.batches) {
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = ring.commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(ring.device, &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate transfer command buffer!");
+			}
+		}
+		return ring;
+	}
 
-		VkPipelineDynamicStateCreateInfo dynamicState = {};
-		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dynamicState.dynamicStateCount = 2;
-		dynamicState.pDynamicStates = dynamicStates;
+	void destroy(DeviceMemoryAllocator& memoryAllocator) {
+		vkDestroyCommandPool(device, commandPool, allocator);
+		memoryAllocator.destroyBuffer(buffer, allocation);
+	}
 
-		VkGraphicsPipelineCreateInfo pipelineInfo = {};
-		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineInfo.stageCount = 2;
-		pipelineInfo.pStages = shaderStages;
-		pipelineInfo.pVertexInputState = &vertexInputInfo;
-		pipelineInfo.pInputAssemblyState = &inputAssembly;
-		pipelineInfo.pViewportState = &viewportState;
-		pipelineInfo.pRasterizationState = &rasterizer;
-		pipelineInfo.pMultisampleState = &multisampling;
-		pipelineInfo.pDepthStencilState = nullptr; // Optional
-		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.pDynamicState = nullptr; // Optional
-		pipelineInfo.layout = pipelineLayout;
-		pipelineInfo.renderPass = renderPass;
-		pipelineInfo.subpass = 0;
-		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-		pipelineInfo.basePipelineIndex = -1; // Optional
+	bool ownershipTransferRequired() const {
+		return transferFamily != graphicsFamily;
+	}
 
-		VkPipeline pipeline;
-		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create graphics pipeline!");
+	// Batches complete in submission order, so ring space is reclaimed from the oldest batch forward.
+	void reclaim(bool wait) {
+		for (uint32_t i = 0; i < MAX_BATCHES; i++) {
+			Batch& batch = batches[(nextBatch + i) % MAX_BATCHES];
+			if (!batch.inFlight) {
+				continue;
+			}
+			if (!scheduler->isComplete(batch.point)) {
+				if (!wait) {
+					return;
+				}
+				scheduler->wait(batch.point);
+			}
+			batch.inFlight = false;
+			tail = batch.ringEnd;
+			if (wait) {
+				return;
+			}
 		}
-		return pipeline;
 	}
-	
-	void createFramebuffers() {
-		swapChainFramebuffers.resize(swapChainCtx.imageViews.size());
-		for (size_t i = 0; i < swapChainCtx.imageViews.size(); i++) {
-			VkImageView attachments[] = {
-				swapChainCtx.imageViews[i]
-			};
 
-			VkFramebufferCreateInfo framebufferInfo = {};
-			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = renderPass;
-			framebufferInfo.attachmentCount = 1;
-			framebufferInfo.pAttachments = attachments;
-			framebufferInfo.width = swapChainCtx.extent.width;
-			framebufferInfo.height = swapChainCtx.extent.height;
-			framebufferInfo.layers = 1;
-
-			if (vkCreateFramebuffer(logicalDeviceCtx.device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to create framebuffer!");
+	VkDeviceSize reserve(VkDeviceSize bytes) {
+		for (;;) {
+			reclaim(false);
+			VkDeviceSize start = (head + COPY_ALIGNMENT - 1) / COPY_ALIGNMENT * COPY_ALIGNMENT;
+			if (start % size + bytes > size) {
+				start += size - start % size;
+			}
+			if (start + bytes - tail <= size) {
+				head = start + bytes;
+				return start % size;
 			}
+			ringStalls++;
+			if (!pending.empty()) {
+				flush();
+			}
+			reclaim(true);
 		}
 	}
 
-	static VkCommandPool createCommandPool(VkDevice device, QueueFamilyIndices queueFamilyIndices) {
-		VkCommandPoolCreateInfo poolInfo = {};
+	void upload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize bytes, VkAccessFlags dstAccessMask) {
+		const char* src = static_cast<const char*>(data);
+		while (bytes > 0) {
+			VkDeviceSize chunk = std::min(bytes, size / 2);
+			VkDeviceSize offset = reserve(chunk);
+			memcpy(static_cast<char*>(allocation.mapped) + offset, src, chunk);
+
+			PendingCopy copy = {};
+			copy.dstBuffer = dstBuffer;
+			copy.region.srcOffset = offset;
+			copy.region.dstOffset = dstOffset;
+			copy.region.size = chunk;
+			copy.dstAccessMask = dstAccessMask;
+			pending.push_back(copy);
+
+			src += chunk;
+			dstOffset += chunk;
+			bytes -= chunk;
+			bytesUploaded += chunk;
+		}
+	}
+
+	void flush() {
+		if (pending.empty()) {
+			return;
+		}
+		Batch& batch = batches[nextBatch];
+		if (batch.inFlight) {
+			reclaim(true);
+		}
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkResetCommandBuffer(batch.commandBuffer, 0);
+		vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+
+		std::vector<VkBufferMemoryBarrier> releases;
+		for (const auto& copy : pending) {
+			vkCmdCopyBuffer(batch.commandBuffer, buffer, copy.dstBuffer, 1, &copy.region);
+			if (ownershipTransferRequired()) {
+				VkBufferMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = 0;
+				barrier.srcQueueFamilyIndex = transferFamily;
+				barrier.dstQueueFamilyIndex = graphicsFamily;
+				barrier.buffer = copy.dstBuffer;
+				barrier.offset = copy.region.dstOffset;
+				barrier.size = copy.region.size;
+				releases.push_back(barrier);
+
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = copy.dstAccessMask;
+				pendingAcquires.push_back(barrier);
+			}
+		}
+		if (!releases.empty()) {
+			vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+				0, nullptr, static_cast<uint32_t>(releases.size()), releases.data(), 0, nullptr);
+		}
+		if (vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record transfer command buffer!");
+		}
+
+		batch.point = scheduler->submit(SubmissionScheduler::QUEUE_TRANSFER, { batch.commandBuffer }, {});
+		pendingWait = batch.point;
+		batch.ringEnd = head;
+		batch.inFlight = true;
+		nextBatch = (nextBatch + 1) % MAX_BATCHES;
+		batchesSubmitted++;
+		pending.clear();
+	}
+
+	// Called while recording the graphics command buffer, outside of a render pass.
+	void recordAcquireBarriers(VkCommandBuffer commandBuffer) {
+		if (pendingAcquires.empty()) {
+			return;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+			0, nullptr, static_cast<uint32_t>(pendingAcquires.size()), pendingAcquires.data(), 0, nullptr);
+		pendingAcquires.clear();
+	}
+
+	// The wait the next graphics submit needs for the batches submitted since the last one.
+	void takeWaits(std::vector<SubmissionScheduler::Dependency>& waits) {
+		if (pendingWait.value != 0) {
+			waits.push_back(scheduler->after(pendingWait, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT));
+			pendingWait = {};
+		}
+	}
+};
+
+// Work-stealing thread pool. Every worker owns a deque: it pops its own jobs from the back and steals from the front of
+// the other deques once it runs dry. The dispatching thread takes part as worker 0, so a job's worker index is always
+// in [0, workerCount()) and can be used to pick per-thread resources.
+struct JobSystem {
+	typedef std::function<void(uint32_t workerIndex)> Job;
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	std::atomic<int32_t> queuedJobs{ 0 };
+	std::atomic<int32_t> remainingJobs{ 0 };
+	std::exception_ptr failure;
+	bool stopping = false;
+
+	// Joins the workers if stop() was never reached, e.g. when startup threw.
+	~JobSystem() {
+		stop();
+	}
+
+	void start(uint32_t workerCount) {
+		workerCount = std::max(workerCount, 1u);
+		stopping = false;
+		for (uint32_t i = 0; i < workerCount; i++) {
+			queues.emplace_back(new WorkQueue());
+		}
+		for (uint32_t i = 1; i < workerCount; i++) {
+			threads.emplace_back(&JobSystem::workerLoop, this, i);
+		}
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			stopping = true;
+		}
+		wakeCondition.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		threads.clear();
+		queues.clear();
+	}
+
+	uint32_t workerCount() const {
+		return static_cast<uint32_t>(queues.size());
+	}
+
+	// Runs every job and returns once all of them have finished. The first exception thrown by a job is rethrown here.
+	void dispatch(std::vector<Job>& jobs) {
+		if (jobs.empty()) {
+			return;
+		}
+		remainingJobs = static_cast<int32_t>(jobs.size());
+		for (size_t i = 0; i < jobs.size(); i++) {
+			WorkQueue& queue = *queues[i % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back(std::move(jobs[i]));
+		}
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			queuedJobs += static_cast<int32_t>(jobs.size());
+		}
+		wakeCondition.notify_all();
+
+		while (runOne(0)) {
+		}
+		{
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			doneCondition.wait(lock, [this] { return remainingJobs == 0; });
+		}
+		if (failure) {
+			std::exception_ptr error = failure;
+			failure = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+	// Queues another job from inside a running one; the enclosing dispatch also waits for it.
+	void spawn(uint32_t workerIndex, Job job) {
+		remainingJobs++;
+		{
+			WorkQueue& own = *queues[workerIndex];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			own.jobs.push_back(std::move(job));
+		}
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			queuedJobs++;
+		}
+		wakeCondition.notify_one();
+	}
+
+	bool pop(uint32_t workerIndex, Job& job) {
+		{
+			WorkQueue& own = *queues[workerIndex];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty()) {
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				queuedJobs--;
+				return true;
+			}
+		}
+		for (size_t i = 1; i < queues.size(); i++) {
+			WorkQueue& victim = *queues[(workerIndex + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				queuedJobs--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool runOne(uint32_t workerIndex) {
+		Job job;
+		if (!pop(workerIndex, job)) {
+			return false;
+		}
+		try {
+			job(workerIndex);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			if (!failure) {
+				failure = std::current_exception();
+			}
+		}
+		if (--remainingJobs == 0) {
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			doneCondition.notify_all();
+		}
+		return true;
+	}
+
+	void workerLoop(uint32_t workerIndex) {
+		for (;;) {
+			if (runOne(workerIndex)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wakeCondition.wait(lock, [this] { return stopping || queuedJobs > 0; });
+			if (stopping) {
+				return;
+			}
+		}
+	}
+};
+
+// Initialization split into named tasks with explicit dependencies. run() starts each task on the job system as soon
+// as the last of its dependencies has finished, on the worker that finished it, and records when every task ran so
+// startup can be profiled stage by stage. Tasks that touch the same non-thread-safe state must depend on each other.
+struct StartupTaskGraph {
+	struct Task {
+		std::string name;
+		std::function<void()> run;
+		uint32_t dependencyCount;
+		std::vector<uint32_t> dependents;
+		uint32_t worker;
+		double startMilliseconds;
+		double endMilliseconds;
+	};
+
+	std::vector<Task> tasks;
+	std::unique_ptr<std::atomic<uint32_t>[]> pending;
+	std::chrono::high_resolution_clock::time_point start;
+	double totalMilliseconds = 0.0;
+
+	uint32_t add(const std::string& name, const std::vector<uint32_t>& dependencies, std::function<void()> run) {
+		Task task = {};
+		task.name = name;
+		task.run = run;
+		task.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		uint32_t index = static_cast<uint32_t>(tasks.size());
+		for (uint32_t dependency : dependencies) {
+			tasks[dependency].dependents.push_back(index);
+		}
+		tasks.push_back(task);
+		return index;
+	}
+
+	// A task that throws never starts its dependents; the first exception is rethrown once everything else has finished.
+	void run(JobSystem& jobSystem) {
+		pending.reset(new std::atomic<uint32_t>[tasks.size()]);
+		std::vector<JobSystem::Job> roots;
+		for (uint32_t i = 0; i < tasks.size(); i++) {
+			pending[i] = tasks[i].dependencyCount;
+			if (tasks[i].dependencyCount == 0) {
+				roots.push_back(makeJob(jobSystem, i));
+			}
+		}
+		start = std::chrono::high_resolution_clock::now();
+		jobSystem.dispatch(roots);
+		totalMilliseconds = elapsedMilliseconds();
+	}
+
+	double elapsedMilliseconds() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	JobSystem::Job makeJob(JobSystem& jobSystem, uint32_t index) {
+		return [this, &jobSystem, index](uint32_t worker) {
+			Task& task = tasks[index];
+			task.worker = worker;
+			task.startMilliseconds = elapsedMilliseconds();
+			task.run();
+			task.endMilliseconds = elapsedMilliseconds();
+			for (uint32_t dependent : task.dependents) {
+				if (--pending[dependent] == 0) {
+					jobSystem.spawn(worker, makeJob(jobSystem, dependent));
+				}
+			}
+		};
+	}
+
+	void printSummary() const {
+		std::vector<const Task*> order;
+		double busyMilliseconds = 0.0;
+		for (const auto& task : tasks) {
+			order.push_back(&task);
+			busyMilliseconds += task.endMilliseconds - task.startMilliseconds;
+		}
+		std::sort(order.begin(), order.end(), [](const Task* a, const Task* b) { return a->startMilliseconds < b->startMilliseconds; });
+		std::cout << "Startup took " << std::fixed << std::setprecision(2) << totalMilliseconds << " ms (" << busyMilliseconds
+			<< " ms of task time across " << tasks.size() << " tasks):" << std::endl;
+		for (const Task* task : order) {
+			std::cout << "\t" << std::left << std::setw(20) << task->name << std::right << " worker " << task->worker
+				<< "  start " << std::setw(8) << task->startMilliseconds << " ms  took " << std::setw(8)
+				<< task->endMilliseconds - task->startMilliseconds << " ms" << std::endl;
+		}
+		std::cout << std::defaultfloat << std::setprecision(6);
+	}
+};
+
+// A transient command pool owned by one recording thread for one frame in flight. The pool is reset wholesale once the
+// frame has completed; the secondary buffers it handed out go back to the initial state and are reused.
+struct ThreadCommandPool {
+	VkCommandPool pool;
+	std::vector<VkCommandBuffer> secondaryBuffers;
+	size_t used;
+
+	static ThreadCommandPool create(VkDevice device, VkAllocationCallbacks* allocator, uint32_t queueFamilyIndex) {
+		ThreadCommandPool ctx = {};
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndex;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if (vkCreateCommandPool(device, &poolInfo, allocator, &ctx.pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create thread command pool!");
+		}
+		return ctx;
+	}
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator) {
+		vkDestroyCommandPool(device, pool, allocator);
+	}
+
+	void reset(VkDevice device) {
+		vkResetCommandPool(device, pool, 0);
+		used = 0;
+	}
+
+	VkCommandBuffer acquireSecondary(VkDevice device) {
+		if (used == secondaryBuffers.size()) {
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+			secondaryBuffers.push_back(commandBuffer);
+		}
+		return secondaryBuffers[used++];
+	}
+};
+
+// Deduplicates descriptor set layouts: identical binding lists map to the same VkDescriptorSetLayout, looked up by a
+// hash of the bindings and confirmed by comparing them.
+struct DescriptorSetLayoutCache {
+	struct Entry {
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		VkDescriptorSetLayout layout;
+	};
+
+	std::unordered_map<size_t, std::vector<Entry>> entries;
+
+	static size_t hashBindings(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&](uint64_t value) {
+			hash = (hash ^ value) * 1099511628211ull;
+		};
+		for (const auto& binding : bindings) {
+			mix(binding.binding);
+			mix(binding.descriptorType);
+			mix(binding.descriptorCount);
+			mix(binding.stageFlags);
+			mix(reinterpret_cast<uintptr_t>(binding.pImmutableSamplers));
+		}
+		return static_cast<size_t>(hash);
+	}
+
+	static bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b) {
+		return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const VkDescriptorSetLayoutBinding& x, const VkDescriptorSetLayoutBinding& y) {
+			return x.binding == y.binding && x.descriptorType == y.descriptorType && x.descriptorCount == y.descriptorCount &&
+				x.stageFlags == y.stageFlags && x.pImmutableSamplers == y.pImmutableSamplers;
+		});
+	}
+
+	// Bindings are sorted by binding number first, so declaration order does not produce distinct layouts.
+	VkDescriptorSetLayout get(VkDevice device, VkAllocationCallbacks* allocator, std::vector<VkDescriptorSetLayoutBinding> bindings) {
+		std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+			return a.binding < b.binding;
+		});
+		std::vector<Entry>& bucket = entries[hashBindings(bindings)];
+		for (const auto& entry : bucket) {
+			if (sameBindings(entry.bindings, bindings)) {
+				return entry.layout;
+			}
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+		Entry entry = {};
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, &entry.layout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor set layout!");
+		}
+		entry.bindings = bindings;
+		bucket.push_back(entry);
+		return entry.layout;
+	}
+
+	size_t size() const {
+		size_t count = 0;
+		for (const auto& bucket : entries) {
+			count += bucket.second.size();
+		}
+		return count;
+	}
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator) {
+		for (auto& bucket : entries) {
+			for (auto& entry : bucket.second) {
+				vkDestroyDescriptorSetLayout(device, entry.layout, allocator);
+			}
+		}
+		entries.clear();
+	}
+};
+
+// Transient descriptor sets for each frame in flight. Sets are carved out of the frame's pools and never freed
+// individually: once the frame has completed, beginFrame resets every pool of that frame in one call. Pools
+// are only created when the existing ones run out, so a steady-state frame makes no pool allocations.
+struct FrameDescriptorAllocator {
+	static const uint32_t SETS_PER_POOL = 256;
+
+	struct FramePools {
+		std::vector<VkDescriptorPool> pools;
+		size_t current;
+	};
+
+	VkDevice device;
+	VkAllocationCallbacks* allocator;
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	std::vector<FramePools> frames;
+	uint32_t frameIndex;
+	uint64_t poolsCreated;
+	uint64_t setsAllocated;
+
+	static FrameDescriptorAllocator create(VkDevice device, VkAllocationCallbacks* allocator, uint32_t framesInFlight) {
+		FrameDescriptorAllocator ctx = {};
+		ctx.device = device;
+		ctx.allocator = allocator;
+		ctx.frames.resize(framesInFlight);
+		// Descriptors per set, on average, for each type a frame may allocate.
+		ctx.poolSizes = {
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 * SETS_PER_POOL },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2 * SETS_PER_POOL },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * SETS_PER_POOL },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, SETS_PER_POOL },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * SETS_PER_POOL },
+			{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, SETS_PER_POOL }
+		};
+		return ctx;
+	}
+
+	void destroy() {
+		for (auto& frame : frames) {
+			for (VkDescriptorPool pool : frame.pools) {
+				vkDestroyDescriptorPool(device, pool, allocator);
+			}
+		}
+	}
+
+	void beginFrame(uint32_t frame) {
+		frameIndex = frame;
+		FramePools& framePools = frames[frame];
+		for (VkDescriptorPool pool : framePools.pools) {
+			vkResetDescriptorPool(device, pool, 0);
+		}
+		framePools.current = 0;
+	}
+
+	VkDescriptorPool createPool() {
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = SETS_PER_POOL;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		VkDescriptorPool pool;
+		if (vkCreateDescriptorPool(device, &poolInfo, allocator, &pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor pool!");
+		}
+		poolsCreated++;
+		return pool;
+	}
+
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+		FramePools& framePools = frames[frameIndex];
+		for (;;) {
+			bool freshPool = framePools.current == framePools.pools.size();
+			if (freshPool) {
+				framePools.pools.push_back(createPool());
+			}
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = framePools.pools[framePools.current];
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &layout;
+			VkDescriptorSet set;
+			VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+			if (result == VK_SUCCESS) {
+				setsAllocated++;
+				return set;
+			}
+			// An empty pool that cannot hold the set means the layout needs more descriptors than poolSizes provides.
+			if (freshPool || (result != VK_ERROR_OUT_OF_POOL_MEMORY_KHR && result != VK_ERROR_FRAGMENTED_POOL)) {
+				throw std::runtime_error("failed to allocate descriptor set!");
+			}
+			framePools.current++;
+		}
+	}
+};
+
+// Frustum-culls a frame's instances on the GPU. The compute pass appends every visible instance to a compacted list
+// and bumps instanceCount of a single indirect draw, so the draw calls never depend on CPU-side visibility.
+struct GpuCullingContext {
+	static const uint32_t WORKGROUP_SIZE = 64;
+
+	// The draw command is followed by the draw count read by vkCmdDrawIndexedIndirectCount*, which lets an empty
+	// frame skip the draw entirely.
+	struct IndirectData {
+		VkDrawIndexedIndirectCommand command;
+		uint32_t drawCount;
+	};
+
+	struct Frame {
+		VkBuffer visibleBuffer;
+		DeviceAllocation visibleAllocation;
+		VkBuffer indirectBuffer;
+		DeviceAllocation indirectAllocation;
+		VkDescriptorSet descriptorSet;
+	};
+
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkDescriptorPool descriptorPool;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	std::vector<Frame> frames;
+	// The KHR and AMD entry points share a signature.
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount;
+
+	static GpuCullingContext create(VkDevice device, VkAllocationCallbacks* allocator, const PhysicalDeviceContext& physicalDeviceCtx, DeviceMemoryAllocator& memoryAllocator,
+		DescriptorSetLayoutCache& layoutCache, VkPipelineCache pipelineCache, VkShaderModule cullShader, const FrameRingBuffer& instanceRing, uint32_t framesInFlight) {
+		GpuCullingContext ctx = {};
+
+		std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+		for (uint32_t i = 0; i < 3; i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		ctx.descriptorSetLayout = layoutCache.get(device, allocator, bindings);
+
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.size = sizeof(ViewConstants);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &ctx.descriptorSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &ctx.pipelineLayout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling pipeline layout!");
+		}
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = cullShader;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = ctx.pipelineLayout;
+		if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, allocator, &ctx.pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling pipeline!");
+		}
+
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSize.descriptorCount = 3 * framesInFlight;
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = framesInFlight;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		if (vkCreateDescriptorPool(device, &poolInfo, allocator, &ctx.descriptorPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling descriptor pool!");
+		}
+
+		ctx.frames.resize(framesInFlight);
+		for (uint32_t i = 0; i < framesInFlight; i++) {
+			Frame& frame = ctx.frames[i];
+			frame.visibleAllocation = memoryAllocator.createBuffer(instanceRing.frameSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, frame.visibleBuffer);
+			frame.indirectAllocation = memoryAllocator.createBuffer(sizeof(IndirectData),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, frame.indirectBuffer);
+
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = ctx.descriptorPool;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &ctx.descriptorSetLayout;
+			if (vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSet) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate culling descriptor set!");
+			}
+
+			VkDescriptorBufferInfo bufferInfos[3] = {};
+			bufferInfos[0].buffer = instanceRing.buffer;
+			bufferInfos[0].offset = i * instanceRing.frameSize;
+			bufferInfos[0].range = instanceRing.frameSize;
+			bufferInfos[1].buffer = frame.visibleBuffer;
+			bufferInfos[1].range = instanceRing.frameSize;
+			bufferInfos[2].buffer = frame.indirectBuffer;
+			bufferInfos[2].range = sizeof(IndirectData);
+			VkWriteDescriptorSet writes[3] = {};
+			for (uint32_t binding = 0; binding < 3; binding++) {
+				writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[binding].dstSet = frame.descriptorSet;
+				writes[binding].dstBinding = binding;
+				writes[binding].descriptorCount = 1;
+				writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[binding].pBufferInfo = &bufferInfos[binding];
+			}
+			vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+		}
+
+		if (physicalDeviceCtx.drawIndirectCountExtension != nullptr) {
+			const char* entryPoint = strcmp(physicalDeviceCtx.drawIndirectCountExtension, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0
+				? "vkCmdDrawIndexedIndirectCountAMD" : "vkCmdDrawIndexedIndirectCountKHR";
+			ctx.drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, entryPoint);
+		}
+		return ctx;
+	}
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator) {
+		for (auto& frame : frames) {
+			memoryAllocator.destroyBuffer(frame.indirectBuffer, frame.indirectAllocation);
+			memoryAllocator.destroyBuffer(frame.visibleBuffer, frame.visibleAllocation);
+		}
+		vkDestroyDescriptorPool(device, descriptorPool, allocator);
+		vkDestroyPipeline(device, pipeline, allocator);
+		vkDestroyPipelineLayout(device, pipelineLayout, allocator);
+	}
+
+	// Records the culling pass for a frame; must be outside of a render pass. The render graph orders the draws after it.
+	void record(VkCommandBuffer commandBuffer, uint32_t frameIndex, const ViewConstants& view, uint32_t indexCount) {
+		const Frame& frame = frames[frameIndex];
+
+		IndirectData initial = {};
+		initial.command.indexCount = indexCount;
+		vkCmdUpdateBuffer(commandBuffer, frame.indirectBuffer, 0, sizeof(IndirectData), &initial);
+
+		VkMemoryBarrier clearBarrier = {};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ViewConstants), &view);
+		vkCmdDispatch(commandBuffer, (view.instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+	}
+
+	void draw(VkCommandBuffer commandBuffer, uint32_t frameIndex) const {
+		const Frame& frame = frames[frameIndex];
+		if (drawIndexedIndirectCount != nullptr) {
+			drawIndexedIndirectCount(commandBuffer, frame.indirectBuffer, 0, frame.indirectBuffer, offsetof(IndirectData, drawCount), 1, sizeof(IndirectData));
+		}
+		else {
+			vkCmdDrawIndexedIndirect(commandBuffer, frame.indirectBuffer, 0, 1, sizeof(IndirectData));
+		}
+	}
+};
+
+// Simulates particles on the async compute queue. The simulation state ping-pongs between two buffers that never leave
+// the compute family; each step also writes the frame's point vertices, which are released to the graphics family and
+// drawn straight from the same buffer. The graphics submit waits on the step's semaphore, so the next frame's step
+// overlaps rasterization of the current one. Without a separate compute family the steps run on the graphics family
+// and need no ownership transfers.
+struct ParticleSimulation {
+	static const uint32_t WORKGROUP_SIZE = 256;
+
+	struct PushConstants {
+		float deltaTime;
+		float time;
+		uint32_t count;
+		uint32_t reset;
+	};
+
+	struct Frame {
+		VkBuffer vertexBuffer;
+		DeviceAllocation vertexAllocation;
+		// Indexed by the state buffer the step reads.
+		VkDescriptorSet descriptorSets[2];
+		VkCommandBuffer commandBuffer;
+		// The compute timeline point of the step that last wrote the vertex buffer.
+		SubmissionScheduler::SyncPoint finished;
+	};
+
+	uint32_t particleCount;
+	uint32_t computeFamily;
+	uint32_t graphicsFamily;
+	VkBuffer stateBuffers[2];
+	DeviceAllocation stateAllocations[2];
+	std::vector<Frame> frames;
+	VkDescriptorPool descriptorPool;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	VkCommandPool commandPool;
+	uint64_t stepCount;
+
+	static ParticleSimulation create(const LogicalDeviceContext& logicalDeviceCtx, const QueueFamilyIndices& queueFamilyIndices,
+		DeviceMemoryAllocator& memoryAllocator, VkAllocationCallbacks* allocator, DescriptorSetLayoutCache& layoutCache,
+		VkPipelineCache pipelineCache, VkShaderModule simulateShader, uint32_t particleCount, uint32_t framesInFlight) {
+		VkDevice device = logicalDeviceCtx.device;
+		ParticleSimulation sim = {};
+		sim.particleCount = particleCount;
+		sim.computeFamily = queueFamilyIndices.compute;
+		sim.graphicsFamily = queueFamilyIndices.graphics;
+
+		for (uint32_t i = 0; i < 2; i++) {
+			sim.stateAllocations[i] = memoryAllocator.createBuffer(VkDeviceSize(particleCount) * sizeof(Particle), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, sim.stateBuffers[i]);
+		}
+
+		std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		VkDescriptorSetLayout setLayout = layoutCache.get(device, allocator, bindings);
+
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.size = sizeof(PushConstants);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &setLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &sim.pipelineLayout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create particle pipeline layout!");
+		}
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = simulateShader;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = sim.pipelineLayout;
+		if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, allocator, &sim.pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create particle pipeline!");
+		}
+
+		VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, framesInFlight * 2 * 3 };
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = framesInFlight * 2;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		if (vkCreateDescriptorPool(device, &poolInfo, allocator, &sim.descriptorPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create particle descriptor pool!");
+		}
+
+		VkCommandPoolCreateInfo commandPoolInfo = {};
+		commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		commandPoolInfo.queueFamilyIndex = sim.computeFamily;
+		commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		if (vkCreateCommandPool(device, &commandPoolInfo, allocator, &sim.commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create particle command pool!");
+		}
+
+		sim.frames.resize(framesInFlight);
+		for (auto& frame : sim.frames) {
+			frame.vertexAllocation = memoryAllocator.createBuffer(VkDeviceSize(particleCount) * sizeof(ParticleVertex),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, frame.vertexBuffer);
+
+			VkDescriptorSetLayout setLayouts[] = { setLayout, setLayout };
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = sim.descriptorPool;
+			allocInfo.descriptorSetCount = 2;
+			allocInfo.pSetLayouts = setLayouts;
+			if (vkAllocateDescriptorSets(device, &allocInfo, frame.descriptorSets) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate particle descriptor sets!");
+			}
+			for (uint32_t read = 0; read < 2; read++) {
+				VkDescriptorBufferInfo bufferInfos[] = {
+					{ sim.stateBuffers[read], 0, VK_WHOLE_SIZE },
+					{ sim.stateBuffers[1 - read], 0, VK_WHOLE_SIZE },
+					{ frame.vertexBuffer, 0, VK_WHOLE_SIZE }
+				};
+				VkWriteDescriptorSet writes[3] = {};
+				for (uint32_t i = 0; i < 3; i++) {
+					writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+					writes[i].dstSet = frame.descriptorSets[read];
+					writes[i].dstBinding = i;
+					writes[i].descriptorCount = 1;
+					writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+					writes[i].pBufferInfo = &bufferInfos[i];
+				}
+				vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+			}
+
+			VkCommandBufferAllocateInfo commandBufferInfo = {};
+			commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			commandBufferInfo.commandPool = sim.commandPool;
+			commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			commandBufferInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(device, &commandBufferInfo, &frame.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate particle command buffer!");
+			}
+		}
+		return sim;
+	}
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator) {
+		for (auto& frame : frames) {
+			memoryAllocator.destroyBuffer(frame.vertexBuffer, frame.vertexAllocation);
+		}
+		for (uint32_t i = 0; i < 2; i++) {
+			memoryAllocator.destroyBuffer(stateBuffers[i], stateAllocations[i]);
+		}
+		vkDestroyCommandPool(device, commandPool, allocator);
+		vkDestroyDescriptorPool(device, descriptorPool, allocator);
+		vkDestroyPipeline(device, pipeline, allocator);
+		vkDestroyPipelineLayout(device, pipelineLayout, allocator);
+	}
+
+	bool ownershipTransferRequired() const {
+		return computeFamily != graphicsFamily;
+	}
+
+	// Queues one step for a frame whose previous graphics submission has completed, so the graphics queue is done with
+	// its vertex buffer and the contents can be discarded without handing ownership back. The first step seeds the state
+	// on the GPU.
+	void simulate(SubmissionScheduler& scheduler, uint32_t frameIndex, float deltaTime, float time) {
+		Frame& frame = frames[frameIndex];
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+
+		// Orders this step after the previous one on the compute queue, which wrote the state read here and read the
+		// state written here.
+		VkMemoryBarrier stateBarrier = {};
+		stateBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		stateBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		stateBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &stateBarrier, 0, nullptr, 0, nullptr);
+
+		PushConstants constants = { deltaTime, time, particleCount, stepCount == 0 ? 1u : 0u };
+		vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSets[stepCount % 2], 0, nullptr);
+		vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+		vkCmdDispatch(frame.commandBuffer, (particleCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+		if (ownershipTransferRequired()) {
+			VkBufferMemoryBarrier release = {};
+			release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			release.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			release.dstAccessMask = 0;
+			release.srcQueueFamilyIndex = computeFamily;
+			release.dstQueueFamilyIndex = graphicsFamily;
+			release.buffer = frame.vertexBuffer;
+			release.offset = 0;
+			release.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+				0, nullptr, 1, &release, 0, nullptr);
+		}
+		if (vkEndCommandBuffer(frame.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record particle command buffer!");
+		}
+
+		frame.finished = scheduler.submit(SubmissionScheduler::QUEUE_COMPUTE, { frame.commandBuffer }, {});
+		stepCount++;
+	}
+
+	// The graphics half of the ownership transfer; recorded before the vertex buffer is drawn.
+	void recordAcquireBarrier(VkCommandBuffer commandBuffer, uint32_t frameIndex) const {
+		if (!ownershipTransferRequired()) {
+			return;
+		}
+		VkBufferMemoryBarrier acquire = {};
+		acquire.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		acquire.srcAccessMask = 0;
+		acquire.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		acquire.srcQueueFamilyIndex = computeFamily;
+		acquire.dstQueueFamilyIndex = graphicsFamily;
+		acquire.buffer = frames[frameIndex].vertexBuffer;
+		acquire.offset = 0;
+		acquire.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+			0, nullptr, 1, &acquire, 0, nullptr);
+	}
+
+	void draw(VkCommandBuffer commandBuffer, uint32_t frameIndex) const {
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &frames[frameIndex].vertexBuffer, &offset);
+		vkCmdDraw(commandBuffer, particleCount, 1, 0, 0);
+	}
+};
+
+// Latency/pacing profile for the swapchain. low-latency prefers tearing or mailbox presentation with the fewest images
+// and samples input just in time; balanced keeps the mailbox-first default; vsync uses FIFO only, which paces steadily
+// at the display rate and lets the CPU and GPU idle between frames.
+struct PresentPolicy {
+	std::string name;
+	std::vector<VkPresentModeKHR> preferredModes;
+	// Images requested on top of the surface minimum, before the imageCount override.
+	uint32_t extraImages;
+	uint32_t imageCount;
+	bool justInTimeInput;
+
+	static PresentPolicy fromName(const std::string& name) {
+		PresentPolicy policy = {};
+		policy.name = name;
+		if (name == "low-latency") {
+			policy.preferredModes = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+			policy.extraImages = 0;
+			policy.justInTimeInput = true;
+		}
+		else if (name == "balanced") {
+			policy.preferredModes = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+			policy.extraImages = 1;
+		}
+		else if (name == "vsync") {
+			policy.extraImages = 1;
+		}
+		else {
+			throw std::runtime_error("unknown present policy: " + name);
+		}
+		return policy;
+	}
+
+	// FIFO is the fallback for every profile since it is the only mode the specification guarantees.
+	VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) const {
+		for (VkPresentModeKHR mode : preferredModes) {
+			if (std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end()) {
+				return mode;
+			}
+		}
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
+	uint32_t chooseImageCount(const VkSurfaceCapabilitiesKHR& capabilities) const {
+		uint32_t count = imageCount > 0 ? imageCount : capabilities.minImageCount + extraImages;
+		count = std::max(count, capabilities.minImageCount);
+		if (capabilities.maxImageCount > 0 && count > capabilities.maxImageCount) {
+			count = capabilities.maxImageCount;
+		}
+		return count;
+	}
+
+	static const char* presentModeName(VkPresentModeKHR mode) {
+		switch (mode) {
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+		default: return "unknown";
+		}
+	}
+};
+
+struct SwapChainContext {
+	VkSwapchainKHR chain;
+	VkExtent2D extent;
+	VkSurfaceFormatKHR surfaceFormat;
+	std::vector<VkImage> images;
+	std::vector<VkImageView> imageViews;
+	// Layout the images are left in at the end of the frame; only offscreen targets own their image memory.
+	VkImageLayout presentLayout;
+	std::vector<DeviceAllocation> imageAllocations;
+	VkPresentModeKHR presentMode;
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator) {
+		for (size_t i = 0; i < imageViews.size(); i++) {
+			vkDestroyImageView(device, imageViews[i], allocator);
+		}
+		if (chain != VK_NULL_HANDLE) {
+			vkDestroySwapchainKHR(device, chain, allocator);
+		}
+		for (size_t i = 0; i < imageAllocations.size(); i++) {
+			memoryAllocator.destroyImage(images[i], imageAllocations[i]);
+		}
+	}
+
+	static VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+		if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED) {
+			return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+		}
+
+		for (const auto& availableFormat : availableFormats) {
+			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+				return availableFormat;
+			}
+		}
+
+		return availableFormats[0];
+	}
+
+	// The format and final layout a swapchain on this device will use. Both are known before the swapchain exists, so
+	// render passes and pipelines can be built while it is being created.
+	static VkSurfaceFormatKHR surfaceFormatFor(const PhysicalDeviceContext& physicalDeviceCtx, bool offscreen) {
+		if (offscreen) {
+			return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+		}
+		return chooseSwapSurfaceFormat(physicalDeviceCtx.swapChainCapabilities.formats);
+	}
+
+	// Whether a surface offering availableFormats can present images of format.
+	static bool supportsFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats, VkSurfaceFormatKHR format) {
+		if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED) {
+			return true;
+		}
+		for (const auto& availableFormat : availableFormats) {
+			if (availableFormat.format == format.format && availableFormat.colorSpace == format.colorSpace) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static VkImageLayout presentLayoutFor(bool offscreen) {
+		return offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	}
+
+	static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D desiredExtent) {
+		if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
+			return capabilities.currentExtent;
+		}
+		else {
+			VkExtent2D actualExtent = desiredExtent;
+
+			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+			return actualExtent;
+		}
+	}
+
+	// desiredExtent is only used when the surface leaves the size up to the swapchain. Passing the chain being replaced
+	// as oldSwapchain lets the driver hand resources over; the caller still owns and must eventually destroy the old one.
+	static SwapChainContext create(VkSurfaceKHR surface, VkDevice device, VkAllocationCallbacks* allocator, PhysicalDeviceContext physicalDeviceCtx, VkExtent2D desiredExtent,
+		VkImageUsageFlags usage, const PresentPolicy& policy, VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE) {
+		SwapChainContext ctx = {};
+		VkSurfaceCapabilitiesKHR capabilities;
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDeviceCtx.physicalDevice, surface, &capabilities);
+		// The render graph is compiled for the first window's format, so every window's surface has to offer it.
+		SwapChainSupportDetails support = SwapChainSupportDetails::querySwapChainSupport(surface, physicalDeviceCtx.physicalDevice);
+		ctx.presentMode = policy.choosePresentMode(support.presentModes);
+		ctx.surfaceFormat = surfaceFormatFor(physicalDeviceCtx, false);
+		if (!supportsFormat(support.formats, ctx.surfaceFormat)) {
+			throw std::runtime_error("surface does not support the render graph's swapchain format!");
+		}
+		ctx.extent = chooseSwapExtent(capabilities, desiredExtent);
+		if ((capabilities.supportedUsageFlags & usage) != usage) {
+			throw std::runtime_error("swapchain images do not support the usage the render graph needs!");
+		}
+
+		uint32_t imageCount = policy.chooseImageCount(capabilities);
+
+		VkSwapchainCreateInfoKHR createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		createInfo.surface = surface;
+		createInfo.minImageCount = imageCount;
+		createInfo.imageFormat = ctx.surfaceFormat.format;
+		createInfo.imageColorSpace = ctx.surfaceFormat.colorSpace;
+		createInfo.imageExtent = ctx.extent;
+		createInfo.imageArrayLayers = 1;
+		createInfo.imageUsage = usage;
+		createInfo.preTransform = capabilities.currentTransform;
+		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		createInfo.presentMode = ctx.presentMode;
+		createInfo.clipped = VK_TRUE;
+		createInfo.oldSwapchain = oldSwapchain;
+
+		uint32_t queueFamilyIndices[] = { (uint32_t)physicalDeviceCtx.queueFamilyIndices.graphics, (uint32_t)physicalDeviceCtx.queueFamilyIndices.present };
+
+		if (physicalDeviceCtx.queueFamilyIndices.graphics != physicalDeviceCtx.queueFamilyIndices.present) {
+			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		else {
+			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			createInfo.queueFamilyIndexCount = 0; // Optional
+			createInfo.pQueueFamilyIndices = nullptr; // Optional
+		}
+
+		if (vkCreateSwapchainKHR(device, &createInfo, allocator, &ctx.chain) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create swap chain!");
+		}
+
+		vkGetSwapchainImagesKHR(device, ctx.chain, &imageCount, nullptr);
+		ctx.images.resize(imageCount);
+		vkGetSwapchainImagesKHR(device, ctx.chain, &imageCount, ctx.images.data());
+		ctx.presentLayout = presentLayoutFor(false);
+
+		createImageViews(device, allocator, ctx);
+		return ctx;
+	}
+
+	static SwapChainContext createOffscreen(VkDevice device, VkAllocationCallbacks* allocator, const PhysicalDeviceContext& physicalDeviceCtx, DeviceMemoryAllocator& memoryAllocator, VkExtent2D extent, uint32_t imageCount) {
+		SwapChainContext ctx = {};
+		ctx.chain = VK_NULL_HANDLE;
+		ctx.extent = extent;
+		ctx.surfaceFormat = surfaceFormatFor(physicalDeviceCtx, true);
+		ctx.presentLayout = presentLayoutFor(true);
+		ctx.images.resize(imageCount);
+		ctx.imageAllocations.resize(imageCount);
+
+		for (uint32_t i = 0; i < imageCount; i++) {
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = ctx.surfaceFormat.format;
+			imageInfo.extent = { extent.width, extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			ctx.imageAllocations[i] = memoryAllocator.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ctx.images[i]);
+		}
+
+		createImageViews(device, allocator, ctx);
+		return ctx;
+	}
+
+	static void createImageViews(VkDevice device, VkAllocationCallbacks* allocator, SwapChainContext& ctx) {
+		ctx.imageViews.resize(ctx.images.size());
+		for (size_t i = 0; i < ctx.images.size(); i++) {
+			VkImageViewCreateInfo createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			createInfo.image = ctx.images[i];
+			createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			createInfo.format = ctx.surfaceFormat.format;
+			createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			createInfo.subresourceRange.baseMipLevel = 0;
+			createInfo.subresourceRange.levelCount = 1;
+			createInfo.subresourceRange.baseArrayLayer = 0;
+			createInfo.subresourceRange.layerCount = 1;
+			if (vkCreateImageView(device, &createInfo, allocator, &ctx.imageViews[i]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create image views!");
+			}
+		}
+	}
+};
+
+// Pipeline cache persisted between runs. The blob is only handed to the driver if its header matches
+// the current device; anything else (another GPU, a driver update) is discarded and the cache starts cold.
+struct PipelineCacheContext {
+	static const size_t HEADER_SIZE = 16 + VK_UUID_SIZE;
+
+	VkPipelineCache cache;
+	std::string path;
+	bool warm;
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator) {
+		vkDestroyPipelineCache(device, cache, allocator);
+	}
+
+	static uint32_t readUint32(const char* data) {
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	static bool validateHeader(const std::vector<char>& data, const PhysicalDeviceContext& physicalDeviceCtx, std::string& reason) {
+		if (data.size() < HEADER_SIZE) {
+			reason = "file is too small";
+			return false;
+		}
+		uint32_t headerLength = readUint32(&data[0]);
+		uint32_t headerVersion = readUint32(&data[4]);
+		uint32_t vendorID = readUint32(&data[8]);
+		uint32_t deviceID = readUint32(&data[12]);
+		if (headerLength < HEADER_SIZE || headerLength > data.size()) {
+			reason = "header length is invalid";
+			return false;
+		}
+		if (headerVersion != 1) {
+			reason = "unknown header version";
+			return false;
+		}
+		if (vendorID != physicalDeviceCtx.properties.vendorID || deviceID != physicalDeviceCtx.properties.deviceID) {
+			reason = "it was created on a different device";
+			return false;
+		}
+		if (memcmp(&data[16], physicalDeviceCtx.properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			reason = "pipelineCacheUUID does not match the current driver";
+			return false;
+		}
+		return true;
+	}
+
+	static PipelineCacheContext create(VkDevice device, VkAllocationCallbacks* allocator, const PhysicalDeviceContext& physicalDeviceCtx, const std::string& path) {
+		PipelineCacheContext ctx = {};
+		ctx.path = path;
+
+		std::vector<char> data;
+		if (!path.empty()) {
+			std::ifstream stream(path, std::ios::in | std::ios::binary);
+			if (stream.is_open()) {
+				data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+				std::string reason;
+				if (!validateHeader(data, physicalDeviceCtx, reason)) {
+					std::cout << "Ignoring stale pipeline cache " << path << ": " << reason << std::endl;
+					data.clear();
+				}
+			}
+		}
+
+		VkPipelineCacheCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		createInfo.initialDataSize = data.size();
+		createInfo.pInitialData = data.empty() ? nullptr : data.data();
+		VkResult result = vkCreatePipelineCache(device, &createInfo, allocator, &ctx.cache);
+		if (result != VK_SUCCESS && !data.empty()) {
+			std::cout << "Driver rejected pipeline cache " << path << "; starting cold" << std::endl;
+			data.clear();
+			createInfo.initialDataSize = 0;
+			createInfo.pInitialData = nullptr;
+			result = vkCreatePipelineCache(device, &createInfo, allocator, &ctx.cache);
+		}
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+		ctx.warm = !data.empty();
+		if (ctx.warm) {
+			std::cout << "Loaded " << data.size() << " bytes of pipeline cache from " << path << std::endl;
+		}
+		return ctx;
+	}
+
+	// Writes to a temporary file first and renames it over the old cache, so a crash mid-write never leaves a torn file behind.
+	void save(VkDevice device) const {
+		if (path.empty()) {
+			return;
+		}
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0) {
+			return;
+		}
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS) {
+			std::cerr << "failed to read back pipeline cache data" << std::endl;
+			return;
+		}
+
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream stream(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+			stream.write(data.data(), size);
+			stream.close();
+			if (!stream) {
+				std::cerr << "failed to write pipeline cache to " << tempPath << std::endl;
+				std::remove(tempPath.c_str());
+				return;
+			}
+		}
+#ifdef _WIN32
+		bool renamed = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		bool renamed = std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+		if (!renamed) {
+			std::cerr << "failed to replace pipeline cache " << path << std::endl;
+			std::remove(tempPath.c_str());
+		}
+	}
+};
+
+// Everything that distinguishes one graphics pipeline from another. Descriptions compare and hash field by field, so
+// they can key a cache of created pipelines instead of each call site building its own create-info structs.
+struct GraphicsPipelineDesc {
+	enum BlendMode {
+		BLEND_OPAQUE,
+		BLEND_ALPHA,
+		BLEND_ADDITIVE
+	};
+
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkShaderModule vertShader = VK_NULL_HANDLE;
+	VkShaderModule fragShader = VK_NULL_HANDLE;
+	// Bound to constant_id 0, 1, ... in both stages.
+	std::vector<uint32_t> specializationConstants;
+	// Full-screen passes generate their vertices in the shader and leave these empty.
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+	BlendMode blendMode = BLEND_OPAQUE;
+
+	size_t hash() const {
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&](uint64_t value) {
+			hash = (hash ^ value) * 1099511628211ull;
+		};
+		mix(reinterpret_cast<uint64_t>(renderPass));
+		mix(subpass);
+		mix(reinterpret_cast<uint64_t>(layout));
+		mix(reinterpret_cast<uint64_t>(vertShader));
+		mix(reinterpret_cast<uint64_t>(fragShader));
+		for (uint32_t constant : specializationConstants) {
+			mix(constant);
+		}
+		for (const auto& binding : bindings) {
+			mix(binding.binding);
+			mix(binding.stride);
+			mix(binding.inputRate);
+		}
+		for (const auto& attribute : attributes) {
+			mix(attribute.location);
+			mix(attribute.binding);
+			mix(attribute.format);
+			mix(attribute.offset);
+		}
+		mix(topology);
+		mix(polygonMode);
+		mix(cullMode);
+		mix(frontFace);
+		mix(blendMode);
+		return static_cast<size_t>(hash);
+	}
+
+	bool operator==(const GraphicsPipelineDesc& other) const {
+		return renderPass == other.renderPass && subpass == other.subpass && layout == other.layout && vertShader == other.vertShader &&
+			fragShader == other.fragShader && specializationConstants == other.specializationConstants &&
+			bindings.size() == other.bindings.size() && std::equal(bindings.begin(), bindings.end(), other.bindings.begin(),
+				[](const VkVertexInputBindingDescription& a, const VkVertexInputBindingDescription& b) {
+					return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+				}) &&
+			attributes.size() == other.attributes.size() && std::equal(attributes.begin(), attributes.end(), other.attributes.begin(),
+				[](const VkVertexInputAttributeDescription& a, const VkVertexInputAttributeDescription& b) {
+					return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+				}) &&
+			topology == other.topology && polygonMode == other.polygonMode && cullMode == other.cullMode &&
+			frontFace == other.frontFace && blendMode == other.blendMode;
+	}
+
+	// Pipelines for the same subpass and layout differ only in state a driver can share, so one may derive from another.
+	bool sameFamily(const GraphicsPipelineDesc& other) const {
+		return renderPass == other.renderPass && subpass == other.subpass && layout == other.layout;
+	}
+
+	VkPipeline create(VkDevice device, VkAllocationCallbacks* allocator, VkPipelineCache pipelineCache, VkPipelineCreateFlags flags, VkPipeline basePipeline) const {
+		std::vector<VkSpecializationMapEntry> specializationEntries;
+		for (uint32_t i = 0; i < specializationConstants.size(); i++) {
+			specializationEntries.push_back({ i, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t) });
+		}
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+		specializationInfo.pMapEntries = specializationEntries.data();
+		specializationInfo.dataSize = specializationConstants.size() * sizeof(uint32_t);
+		specializationInfo.pData = specializationConstants.data();
+		const VkSpecializationInfo* specialization = specializationConstants.empty() ? nullptr : &specializationInfo;
+
+		VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		vertShaderStageInfo.module = vertShader;
+		vertShaderStageInfo.pSpecializationInfo = specialization;
+		vertShaderStageInfo.pName = "main";
+
+		VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		fragShaderStageInfo.module = fragShader;
+		fragShaderStageInfo.pSpecializationInfo = specialization;
+		fragShaderStageInfo.pName = "main";
+
+		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+		vertexInputInfo.pVertexBindingDescriptions = bindings.data();
+		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+		vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssembly.topology = topology;
+		inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		// Viewport and scissor are dynamic so the pipeline survives swapchain resizes.
+		VkPipelineViewportStateCreateInfo viewportState = {};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.pViewports = nullptr;
+		viewportState.scissorCount = 1;
+		viewportState.pScissors = nullptr;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer = {};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.depthClampEnable = VK_FALSE;
+		rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		rasterizer.polygonMode = polygonMode;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = cullMode;
+		rasterizer.frontFace = frontFace;
+		rasterizer.depthBiasEnable = VK_FALSE;
+		rasterizer.depthBiasConstantFactor = 0.0f; // Optional
+		rasterizer.depthBiasClamp = 0.0f; // Optional
+		rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+
+		VkPipelineMultisampleStateCreateInfo multisampling = {};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.sampleShadingEnable = VK_FALSE;
+		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		multisampling.minSampleShading = 1.0f; // Optional
+		multisampling.pSampleMask = nullptr; // Optional
+		multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
+		multisampling.alphaToOneEnable = VK_FALSE; // Optional
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachment.blendEnable = blendMode == BLEND_OPAQUE ? VK_FALSE : VK_TRUE;
+		colorBlendAttachment.srcColorBlendFactor = blendMode == BLEND_ALPHA ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstColorBlendFactor = blendMode == BLEND_ALPHA ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA
+			: blendMode == BLEND_ADDITIVE ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstAlphaBlendFactor = blendMode == BLEND_OPAQUE ? VK_BLEND_FACTOR_ZERO : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+		VkPipelineColorBlendStateCreateInfo colorBlending = {};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+		colorBlending.blendConstants[0] = 0.0f; // Optional
+		colorBlending.blendConstants[1] = 0.0f; // Optional
+		colorBlending.blendConstants[2] = 0.0f; // Optional
+		colorBlending.blendConstants[3] = 0.0f; // Optional
+
+		VkDynamicState dynamicStates[] = {
+			VK_DYNAMIC_STATE_VIEWPORT,
+			VK_DYNAMIC_STATE_SCISSOR
+		};
+
+		VkPipelineDynamicStateCreateInfo dynamicState = {};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = 2;
+		dynamicState.pDynamicStates = dynamicStates;
+
+		VkGraphicsPipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = 2;
+		pipelineInfo.pStages = shaderStages;
+		pipelineInfo.pVertexInputState = &vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pDepthStencilState = nullptr; // Optional
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.flags = flags;
+		pipelineInfo.layout = layout;
+		pipelineInfo.renderPass = renderPass;
+		pipelineInfo.subpass = subpass;
+		pipelineInfo.basePipelineHandle = basePipeline;
+		pipelineInfo.basePipelineIndex = -1;
+
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, allocator, &pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create graphics pipeline!");
+		}
+		return pipeline;
+	}
+};
+
+// Created graphics pipelines keyed by description. get() compiles a miss on the calling thread; request() queues it
+// for the compiler threads and returns at once, and until that pipeline is ready resolve() hands out its fallback, so
+// a new state combination never stalls recording. With derivatives enabled the first pipeline of each family allows
+// derivatives and the rest of the family is derived from it, which helps drivers that share compiled state.
+struct GraphicsPipelineCache {
+	typedef uint32_t Handle;
+	static const Handle NO_FALLBACK = ~0u;
+	// Entries live in a fixed array and are never removed, so recording threads read them without taking the lock.
+	static const uint32_t MAX_PIPELINES = 4096;
+
+	struct Entry {
+		GraphicsPipelineDesc desc;
+		std::atomic<VkPipeline> pipeline{ VK_NULL_HANDLE };
+		std::atomic<bool> failed{ false };
+		Handle fallback;
+		bool allowsDerivatives;
+	};
+
+	VkDevice device;
+	VkAllocationCallbacks* allocator;
+	VkPipelineCache pipelineCache;
+	bool derivatives;
+	std::unique_ptr<Entry[]> entries;
+	uint32_t entryCount = 0;
+	std::unordered_map<size_t, std::vector<Handle>> lookup;
+	std::mutex mutex;
+	std::condition_variable readyCondition;
+	std::condition_variable compileCondition;
+	std::deque<Handle> compileQueue;
+	std::vector<std::thread> compilers;
+	bool stopping = false;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t backgroundCompiles = 0;
+	uint64_t derivativesCreated = 0;
+	std::atomic<uint64_t> fallbackBinds{ 0 };
+
+	void start(VkDevice device, VkAllocationCallbacks* allocator, VkPipelineCache pipelineCache, uint32_t compilerThreads, bool derivatives) {
+		this->device = device;
+		this->allocator = allocator;
+		this->pipelineCache = pipelineCache;
+		this->derivatives = derivatives;
+		entries.reset(new Entry[MAX_PIPELINES]);
+		stopping = false;
+		for (uint32_t i = 0; i < std::max(compilerThreads, 1u); i++) {
+			compilers.emplace_back(&GraphicsPipelineCache::compileLoop, this);
+		}
+	}
+
+	// Pipelines still queued when the cache is destroyed are never compiled.
+	void destroy() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		compileCondition.notify_all();
+		for (auto& thread : compilers) {
+			thread.join();
+		}
+		compilers.clear();
+		for (uint32_t i = 0; i < entryCount; i++) {
+			if (entries[i].pipeline != VK_NULL_HANDLE) {
+				vkDestroyPipeline(device, entries[i].pipeline, allocator);
+			}
+		}
+		entries.reset();
+		entryCount = 0;
+		lookup.clear();
+	}
+
+	// Returns the pipeline for desc, compiling it on this thread if nobody has asked for it yet.
+	Handle get(const GraphicsPipelineDesc& desc) {
+		bool added;
+		Handle handle;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			handle = findOrAdd(desc, NO_FALLBACK, added);
+		}
+		if (added) {
+			compile(handle);
+		}
+		else {
+			std::unique_lock<std::mutex> lock(mutex);
+			readyCondition.wait(lock, [&] { return entries[handle].pipeline != VK_NULL_HANDLE || entries[handle].failed; });
+		}
+		if (entries[handle].failed) {
+			throw std::runtime_error("failed to create graphics pipeline!");
+		}
+		return handle;
+	}
+
+	// Returns immediately; resolve() binds fallback until the compiler threads have built desc.
+	Handle request(const GraphicsPipelineDesc& desc, Handle fallback) {
+		bool added;
+		std::lock_guard<std::mutex> lock(mutex);
+		Handle handle = findOrAdd(desc, fallback, added);
+		if (added) {
+			compileQueue.push_back(handle);
+			compileCondition.notify_one();
+		}
+		return handle;
+	}
+
+	// Safe to call from any recording thread.
+	VkPipeline resolve(Handle handle) {
+		for (;;) {
+			Entry& entry = entries[handle];
+			if (entry.failed) {
+				throw std::runtime_error("failed to create graphics pipeline!");
+			}
+			VkPipeline pipeline = entry.pipeline;
+			if (pipeline != VK_NULL_HANDLE) {
+				return pipeline;
+			}
+			if (entry.fallback == NO_FALLBACK) {
+				throw std::runtime_error("graphics pipeline is not ready and has no fallback!");
+			}
+			fallbackBinds++;
+			handle = entry.fallback;
+		}
+	}
+
+	// Called with the mutex held.
+	Handle findOrAdd(const GraphicsPipelineDesc& desc, Handle fallback, bool& added) {
+		std::vector<Handle>& bucket = lookup[desc.hash()];
+		for (Handle handle : bucket) {
+			if (entries[handle].desc == desc) {
+				hits++;
+				added = false;
+				return handle;
+			}
+		}
+		if (entryCount == MAX_PIPELINES) {
+			throw std::runtime_error("too many graphics pipelines!");
+		}
+		Handle handle = entryCount++;
+		entries[handle].desc = desc;
+		entries[handle].fallback = fallback;
+		entries[handle].allowsDerivatives = false;
+		bucket.push_back(handle);
+		misses++;
+		added = true;
+		return handle;
+	}
+
+	void compile(Handle handle) {
+		Entry& entry = entries[handle];
+		VkPipelineCreateFlags flags = 0;
+		VkPipeline basePipeline = VK_NULL_HANDLE;
+		if (derivatives) {
+			std::lock_guard<std::mutex> lock(mutex);
+			for (uint32_t i = 0; i < entryCount && basePipeline == VK_NULL_HANDLE; i++) {
+				if (entries[i].allowsDerivatives && entries[i].desc.sameFamily(entry.desc)) {
+					basePipeline = entries[i].pipeline;
+				}
+			}
+			flags = basePipeline != VK_NULL_HANDLE ? VK_PIPELINE_CREATE_DERIVATIVE_BIT : VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+		}
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		try {
+			pipeline = entry.desc.create(device, allocator, pipelineCache, flags, basePipeline);
+		}
+		catch (...) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				entry.failed = true;
+			}
+			readyCondition.notify_all();
+			throw;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			entry.allowsDerivatives = (flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0;
+			entry.pipeline = pipeline;
+			if (basePipeline != VK_NULL_HANDLE) {
+				derivativesCreated++;
+			}
+		}
+		readyCondition.notify_all();
+	}
+
+	// A failed background compile is reported by the next resolve() of that pipeline.
+	void compileLoop() {
+		for (;;) {
+			Handle handle;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				compileCondition.wait(lock, [this] { return stopping || !compileQueue.empty(); });
+				if (stopping) {
+					return;
+				}
+				handle = compileQueue.front();
+				compileQueue.pop_front();
+			}
+			try {
+				compile(handle);
+				std::lock_guard<std::mutex> lock(mutex);
+				backgroundCompiles++;
+			}
+			catch (const std::exception&) {
+			}
+		}
+	}
+
+	void printSummary() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::cout << "Graphics pipeline cache: " << entryCount << " pipelines (" << hits << " hits, " << misses << " misses), "
+			<< backgroundCompiles << " compiled in the background, " << fallbackBinds << " fallback binds";
+		if (derivatives) {
+			std::cout << ", " << derivativesCreated << " derivatives";
+		}
+		std::cout << std::endl;
+	}
+};
+
+struct RollingHistogram {
+	static const size_t WINDOW_SIZE = 1024;
+
+	struct Summary {
+		uint64_t count;
+		double min;
+		double avg;
+		double p95;
+		double p99;
+		double max;
+	};
+
+	// Only the most recent capacity samples are kept and summarized.
+	size_t capacity;
+	std::vector<double> window;
+	size_t next = 0;
+	uint64_t total = 0;
+
+	explicit RollingHistogram(size_t capacity = WINDOW_SIZE) : capacity(capacity) {}
+
+	void add(double sample) {
+		if (window.size() < capacity) {
+			window.push_back(sample);
+		}
+		else {
+			window[next] = sample;
+		}
+		next = (next + 1) % capacity;
+		total++;
+	}
+
+	Summary summarize() const {
+		Summary summary = {};
+		summary.count = total;
+		if (window.empty()) {
+			return summary;
+		}
+		std::vector<double> sorted(window);
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for (double sample : sorted) {
+			sum += sample;
+		}
+		summary.min = sorted.front();
+		summary.max = sorted.back();
+		summary.avg = sum / sorted.size();
+		summary.p95 = sorted[static_cast<size_t>(0.95 * (sorted.size() - 1))];
+		summary.p99 = sorted[static_cast<size_t>(0.99 * (sorted.size() - 1))];
+		return summary;
+	}
+};
+
+// Measures CPU-side frame pacing: the interval between consecutive submissions, the change in that interval from one
+// frame to the next (jitter) and how many frames were queued on the GPU at submit time. With just-in-time input the
+// pacer also sleeps before input is sampled for as long as the frame would otherwise have blocked on its submission or on
+// image acquisition, keeping a small safety margin, so input is read as late as possible.
+struct FramePacer {
+	typedef std::chrono::high_resolution_clock Clock;
+
+	static constexpr double SAFETY_MARGIN_MS = 1.0;
+	static constexpr double SMOOTHING = 0.1;
+
+	bool justInTime = false;
+	bool hasLastSubmit = false;
+	Clock::time_point lastSubmit;
+	double previousInterval = 0.0;
+	// Smoothed time the CPU spent either sleeping here or blocked on the GPU per frame.
+	double slackEstimate = 0.0;
+	double lastSleep = 0.0;
+	double sleptMilliseconds = 0.0;
+	RollingHistogram intervals;
+	RollingHistogram jitter;
+	RollingHistogram queueDepth;
+
+	void throttle() {
+		lastSleep = 0.0;
+		if (!justInTime) {
+			return;
+		}
+		double sleepMs = slackEstimate - SAFETY_MARGIN_MS;
+		if (sleepMs > 0.0) {
+			auto start = Clock::now();
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(sleepMs));
+			lastSleep = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			sleptMilliseconds += lastSleep;
+		}
+	}
+
+	void frameBlocked(double blockedMs) {
+		slackEstimate += SMOOTHING * (lastSleep + blockedMs - slackEstimate);
+	}
+
+	void frameSubmitted(uint32_t framesQueued) {
+		auto now = Clock::now();
+		if (hasLastSubmit) {
+			double interval = std::chrono::duration<double, std::milli>(now - lastSubmit).count();
+			intervals.add(interval);
+			if (previousInterval > 0.0) {
+				jitter.add(std::abs(interval - previousInterval));
+			}
+			previousInterval = interval;
+		}
+		lastSubmit = now;
+		hasLastSubmit = true;
+		queueDepth.add(framesQueued);
+	}
+
+	void resetMeasurements(size_t capacity) {
+		intervals = RollingHistogram(capacity);
+		jitter = RollingHistogram(capacity);
+		queueDepth = RollingHistogram(capacity);
+		hasLastSubmit = false;
+		previousInterval = 0.0;
+		sleptMilliseconds = 0.0;
+	}
+
+	void printSummary() const {
+		RollingHistogram::Summary interval = intervals.summarize();
+		RollingHistogram::Summary delta = jitter.summarize();
+		RollingHistogram::Summary depth = queueDepth.summarize();
+		std::cout << "Frame interval avg " << interval.avg << " ms, p99 " << interval.p99 << " ms; jitter avg " << delta.avg
+			<< " ms, p99 " << delta.p99 << " ms; queue depth avg " << depth.avg << ", max " << depth.max << std::endl;
+		if (justInTime) {
+			std::cout << "Just-in-time input slept " << sleptMilliseconds << " ms in total" << std::endl;
+		}
+	}
+};
+
+// Brackets named scopes of a frame's command buffer with timestamp (and optionally pipeline statistics) queries.
+// Each frame in flight owns its own pools, so results are read back once that frame has completed and never stall.
+struct GpuProfiler {
+	static const uint32_t MAX_SCOPES_PER_FRAME = 32;
+	static const uint32_t STATISTICS_COUNT = 6;
+
+	struct FrameQueries {
+		VkQueryPool timestampPool;
+		VkQueryPool statisticsPool;
+		std::vector<uint32_t> scopes;
+		std::vector<bool> scopeHasStatistics;
+		bool pending;
+	};
+
+	bool timestampsEnabled;
+	bool statisticsEnabled;
+	double timestampPeriod;
+	uint64_t timestampMask;
+	std::vector<FrameQueries> frames;
+	uint32_t currentFrame;
+	bool statisticsActive;
+	std::vector<std::string> scopeNames;
+	std::vector<RollingHistogram> timings;
+	std::vector<std::vector<RollingHistogram>> statistics;
+	// From the start of a frame's first scope to the end of its last one.
+	RollingHistogram frameTimings;
+	// The frame time of the last collect call; negative when that frame has no complete measurement.
+	double lastFrameMilliseconds;
+
+	static const char* statisticName(uint32_t index) {
+		static const char* names[STATISTICS_COUNT] = {
+			"input_assembly_vertices",
+			"input_assembly_primitives",
+			"vertex_shader_invocations",
+			"clipping_invocations",
+			"clipping_primitives",
+			"fragment_shader_invocations"
+		};
+		return names[index];
+	}
+
+	void destroy(VkDevice device, VkAllocationCallbacks* allocator) {
+		for (auto& frame : frames) {
+			if (frame.timestampPool != VK_NULL_HANDLE) {
+				vkDestroyQueryPool(device, frame.timestampPool, allocator);
+			}
+			if (frame.statisticsPool != VK_NULL_HANDLE) {
+				vkDestroyQueryPool(device, frame.statisticsPool, allocator);
+			}
+		}
+	}
+
+	static GpuProfiler create(VkDevice device, VkAllocationCallbacks* allocator, const PhysicalDeviceContext& physicalDeviceCtx, uint32_t framesInFlight, bool enableStatistics) {
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceCtx.physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceCtx.physicalDevice, &queueFamilyCount, queueFamilies.data());
+		uint32_t validBits = queueFamilies[physicalDeviceCtx.queueFamilyIndices.graphics].timestampValidBits;
+
+		GpuProfiler profiler;
+		profiler.timestampsEnabled = validBits > 0;
+		profiler.statisticsEnabled = enableStatistics && physicalDeviceCtx.features.pipelineStatisticsQuery;
+		profiler.timestampPeriod = physicalDeviceCtx.properties.limits.timestampPeriod;
+		profiler.timestampMask = validBits >= 64 ? ~0ULL : ((1ULL << validBits) - 1);
+		profiler.currentFrame = 0;
+		profiler.statisticsActive = false;
+		profiler.lastFrameMilliseconds = -1.0;
+		if (!profiler.timestampsEnabled) {
+			std::cout << "GPU timestamps are not supported on the graphics queue; GPU timings are disabled" << std::endl;
+		}
+		if (enableStatistics && !profiler.statisticsEnabled) {
+			std::cout << "Pipeline statistics queries are not supported by this device" << std::endl;
+		}
+
+		profiler.frames.resize(framesInFlight);
+		for (auto& frame : profiler.frames) {
+			frame.timestampPool = VK_NULL_HANDLE;
+			frame.statisticsPool = VK_NULL_HANDLE;
+			frame.pending = false;
+			if (profiler.timestampsEnabled) {
+				VkQueryPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				poolInfo.queryCount = MAX_SCOPES_PER_FRAME * 2;
+				if (vkCreateQueryPool(device, &poolInfo, allocator, &frame.timestampPool) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create timestamp query pool!");
+				}
+			}
+			if (profiler.statisticsEnabled) {
+				VkQueryPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+				poolInfo.queryCount = MAX_SCOPES_PER_FRAME;
+				poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+					VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+					VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+					VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+					VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+					VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+				if (vkCreateQueryPool(device, &poolInfo, allocator, &frame.statisticsPool) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create pipeline statistics query pool!");
+				}
+			}
+		}
+		return profiler;
+	}
+
+	uint32_t findScope(const std::string& name) {
+		auto it = std::find(scopeNames.begin(), scopeNames.end(), name);
+		if (it != scopeNames.end()) {
+			return static_cast<uint32_t>(it - scopeNames.begin());
+		}
+		scopeNames.push_back(name);
+		timings.emplace_back();
+		statistics.emplace_back(static_cast<size_t>(STATISTICS_COUNT));
+		return static_cast<uint32_t>(scopeNames.size() - 1);
+	}
+
+	// Must be recorded outside of any render pass, before the first scope of the frame.
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+		currentFrame = frameIndex;
+		FrameQueries& frame = frames[frameIndex];
+		frame.scopes.clear();
+		frame.scopeHasStatistics.clear();
+		frame.pending = true;
+		if (frame.timestampPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffer, frame.timestampPool, 0, MAX_SCOPES_PER_FRAME * 2);
+		}
+		if (frame.statisticsPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffer, frame.statisticsPool, 0, MAX_SCOPES_PER_FRAME);
+		}
+	}
+
+	// Returns a slot to pass to endScope. Pipeline statistics are only gathered for the outermost scope,
+	// since queries of the same type may not be nested.
+	uint32_t beginScope(VkCommandBuffer commandBuffer, const std::string& name) {
+		FrameQueries& frame = frames[currentFrame];
+		if (!timestampsEnabled && !statisticsEnabled) {
+			return UINT32_MAX;
+		}
+		if (frame.scopes.size() >= MAX_SCOPES_PER_FRAME) {
+			throw std::runtime_error("too many GPU profiler scopes in one frame!");
+		}
+		uint32_t slot = static_cast<uint32_t>(frame.scopes.size());
+		frame.scopes.push_back(findScope(name));
+		frame.scopeHasStatistics.push_back(statisticsEnabled && !statisticsActive);
+		if (timestampsEnabled) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampPool, slot * 2);
+		}
+		if (frame.scopeHasStatistics[slot]) {
+			vkCmdBeginQuery(commandBuffer, frame.statisticsPool, slot, 0);
+			statisticsActive = true;
+		}
+		return slot;
+	}
+
+	void endScope(VkCommandBuffer commandBuffer, uint32_t slot) {
+		if (slot == UINT32_MAX) {
+			return;
+		}
+		FrameQueries& frame = frames[currentFrame];
+		if (frame.scopeHasStatistics[slot]) {
+			vkCmdEndQuery(commandBuffer, frame.statisticsPool, slot);
+			statisticsActive = false;
+		}
+		if (timestampsEnabled) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestampPool, slot * 2 + 1);
+		}
+	}
+
+	// Call once the frame has completed; results that are somehow not yet available are dropped rather than waited on.
+	void collect(VkDevice device, uint32_t frameIndex) {
+		FrameQueries& frame = frames[frameIndex];
+		lastFrameMilliseconds = -1.0;
+		if (!frame.pending || frame.scopes.empty()) {
+			frame.pending = false;
+			return;
+		}
+		frame.pending = false;
+		uint32_t scopeCount = static_cast<uint32_t>(frame.scopes.size());
+
+		if (timestampsEnabled) {
+			// Each query yields a value followed by its availability word.
+			std::vector<uint64_t> results(scopeCount * 2 * 2);
+			vkGetQueryPoolResults(device, frame.timestampPool, 0, scopeCount * 2, results.size() * sizeof(uint64_t), results.data(),
+				2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			for (uint32_t i = 0; i < scopeCount; i++) {
+				uint64_t begin = results[i * 4 + 0];
+				uint64_t end = results[i * 4 + 2];
+				if (results[i * 4 + 1] == 0 || results[i * 4 + 3] == 0) {
+					continue;
+				}
+				uint64_t ticks = (end - begin) & timestampMask;
+				timings[frame.scopes[i]].add(ticks * timestampPeriod / 1e6);
+			}
+			uint32_t last = scopeCount - 1;
+			if (results[1] != 0 && results[last * 4 + 3] != 0) {
+				uint64_t ticks = (results[last * 4 + 2] - results[0]) & timestampMask;
+				lastFrameMilliseconds = ticks * timestampPeriod / 1e6;
+				frameTimings.add(lastFrameMilliseconds);
+			}
+		}
+
+		if (statisticsEnabled) {
+			const uint32_t stride = STATISTICS_COUNT + 1;
+			std::vector<uint64_t> results(scopeCount * stride);
+			vkGetQueryPoolResults(device, frame.statisticsPool, 0, scopeCount, results.size() * sizeof(uint64_t), results.data(),
+				stride * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			for (uint32_t i = 0; i < scopeCount; i++) {
+				if (!frame.scopeHasStatistics[i] || results[i * stride + STATISTICS_COUNT] == 0) {
+					continue;
+				}
+				for (uint32_t s = 0; s < STATISTICS_COUNT; s++) {
+					statistics[frame.scopes[i]][s].add(static_cast<double>(results[i * stride + s]));
+				}
+			}
+		}
+	}
+
+	// Drops everything measured so far, e.g. at the end of a warm-up.
+	void resetMeasurements(size_t capacity) {
+		for (size_t i = 0; i < scopeNames.size(); i++) {
+			timings[i] = RollingHistogram(capacity);
+			statistics[i].assign(STATISTICS_COUNT, RollingHistogram(capacity));
+		}
+		frameTimings = RollingHistogram(capacity);
+	}
+
+	void collectAll(VkDevice device) {
+		for (uint32_t i = 0; i < frames.size(); i++) {
+			collect(device, i);
+		}
+	}
+
+	void printSummary() const {
+		for (size_t i = 0; i < scopeNames.size(); i++) {
+			auto summary = timings[i].summarize();
+			if (summary.count == 0) {
+				continue;
+			}
+			std::cout << "GPU " << scopeNames[i] << ": min " << summary.min << " ms, avg " << summary.avg << " ms, p95 "
+				<< summary.p95 << " ms, p99 " << summary.p99 << " ms (" << summary.count << " samples)" << std::endl;
+		}
+	}
+
+	static void writeJsonSummary(std::ostream& out, const RollingHistogram::Summary& summary) {
+		out << "{ \"count\": " << summary.count << ", \"min\": " << summary.min << ", \"avg\": " << summary.avg
+			<< ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max << " }";
+	}
+
+	void writeJson(const std::string& filename) const {
+		std::ofstream out(filename, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			throw std::runtime_error("failed to open " + filename + " for writing!");
+		}
+		out << std::setprecision(6) << std::fixed;
+		out << "{\n  \"timestamp_period_ns\": " << timestampPeriod << ",\n  \"scopes\": [";
+		for (size_t i = 0; i < scopeNames.size(); i++) {
+			out << (i == 0 ? "\n" : ",\n") << "    { \"name\": \"" << scopeNames[i] << "\", \"gpu_ms\": ";
+			writeJsonSummary(out, timings[i].summarize());
+			if (statisticsEnabled) {
+				out << ", \"pipeline_statistics\": {";
+				for (uint32_t s = 0; s < STATISTICS_COUNT; s++) {
+					out << (s == 0 ? " " : ", ") << "\"" << statisticName(s) << "\": ";
+					writeJsonSummary(out, statistics[i][s].summarize());
+				}
+				out << " }";
+			}
+			out << " }";
+		}
+		out << "\n  ]\n}\n";
+	}
+
+	void writeCsv(const std::string& filename) const {
+		std::ofstream out(filename, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			throw std::runtime_error("failed to open " + filename + " for writing!");
+		}
+		out << std::setprecision(6) << std::fixed;
+		out << "scope,metric,count,min,avg,p95,p99,max\n";
+		auto writeRow = [&](const std::string& scope, const char* metric, const RollingHistogram::Summary& summary) {
+			out << scope << "," << metric << "," << summary.count << "," << summary.min << "," << summary.avg << ","
+				<< summary.p95 << "," << summary.p99 << "," << summary.max << "\n";
+		};
+		for (size_t i = 0; i < scopeNames.size(); i++) {
+			writeRow(scopeNames[i], "gpu_ms", timings[i].summarize());
+			if (statisticsEnabled) {
+				for (uint32_t s = 0; s < STATISTICS_COUNT; s++) {
+					writeRow(scopeNames[i], statisticName(s), statistics[i][s].summarize());
+				}
+			}
+		}
+	}
+};
+
+// Picks the fraction of the output extent the scene is drawn at so that the GPU frame time stays within a budget. GPU
+// time is modelled as growing with the pixel count, so every measurement is divided by the square of the scale its
+// frame was drawn at; results arrive frames in flight late, by which point the scale may have moved on. The cost
+// estimate follows a rise at once and decays slowly, and growth is rate limited, so a load spike shrinks the scale
+// on the next frame while one cheap frame does not bring full resolution straight back.
+struct ResolutionController {
+	static constexpr double SMOOTHING = 0.1;
+	// Aim a little below the budget so ordinary jitter does not overrun it.
+	static constexpr double HEADROOM = 0.9;
+	static constexpr float MAX_GROWTH = 0.05f;
+	// Smaller changes are ignored so the scene target is not resampled at a slightly different size every frame.
+	static constexpr float MIN_CHANGE = 0.01f;
+
+	// 0 keeps the scale at maxScale.
+	double targetMilliseconds;
+	float minScale;
+	float maxScale;
+	float scale;
+	// Estimated GPU frame time at a scale of 1.
+	double fullScaleMilliseconds;
+	// The scale each frame in flight was drawn at.
+	std::vector<float> frameScales;
+	uint64_t adjustments;
+	RollingHistogram scales;
+
+	static ResolutionController create(double targetMilliseconds, float minScale, float maxScale, uint32_t framesInFlight) {
+		ResolutionController controller;
+		controller.targetMilliseconds = targetMilliseconds;
+		controller.minScale = minScale;
+		controller.maxScale = maxScale;
+		controller.scale = maxScale;
+		controller.fullScaleMilliseconds = 0.0;
+		controller.frameScales.assign(framesInFlight, maxScale);
+		controller.adjustments = 0;
+		return controller;
+	}
+
+	// Call once the frame in flight has completed and before it is recorded again; gpuMilliseconds is negative when
+	// the frame was not measured.
+	void update(uint32_t frameIndex, double gpuMilliseconds) {
+		if (targetMilliseconds > 0.0 && gpuMilliseconds > 0.0) {
+			float drawnAt = frameScales[frameIndex];
+			double cost = gpuMilliseconds / (drawnAt * drawnAt);
+			fullScaleMilliseconds = cost > fullScaleMilliseconds ? cost : fullScaleMilliseconds + SMOOTHING * (cost - fullScaleMilliseconds);
+			float next = static_cast<float>(std::sqrt(targetMilliseconds * HEADROOM / fullScaleMilliseconds));
+			next = std::max(minScale, std::min(std::min(next, scale + MAX_GROWTH), maxScale));
+			if (next != scale && (std::fabs(next - scale) >= MIN_CHANGE || next == minScale || next == maxScale)) {
+				scale = next;
+				adjustments++;
+			}
+		}
+		frameScales[frameIndex] = scale;
+		scales.add(scale);
+	}
+
+	VkExtent2D apply(VkExtent2D extent) const {
+		return {
+			std::min(extent.width, std::max(1u, static_cast<uint32_t>(extent.width * scale + 0.5f))),
+			std::min(extent.height, std::max(1u, static_cast<uint32_t>(extent.height * scale + 0.5f)))
+		};
+	}
+
+	void printSummary() const {
+		RollingHistogram::Summary summary = scales.summarize();
+		std::cout << "Dynamic resolution: scale avg " << summary.avg << " (min " << summary.min << ", max " << summary.max << "), "
+			<< adjustments << " adjustments";
+		if (targetMilliseconds > 0.0) {
+			std::cout << ", GPU budget " << targetMilliseconds << " ms";
+		}
+		std::cout << std::endl;
+	}
+};
+
+// Per-frame render graph. Passes declare the images and buffers they touch and how; compile() culls passes that
+// contribute nothing to an imported resource, orders the rest, merges consecutive graphics passes into subpasses of one
+// render pass when the later one only consumes the earlier one's attachments in place, and plans every barrier and
+// layout transition up front. Images used only as attachments inside one render pass become transient and prefer lazily
+// allocated memory; other internal images with disjoint lifetimes share memory. Render passes depend only on formats,
+// so realize() can rebuild the images and framebuffers for a new extent without invalidating pipelines.
+struct RenderGraph {
+	enum AccessType {
+		ACCESS_COLOR_ATTACHMENT,
+		ACCESS_DEPTH_ATTACHMENT,
+		ACCESS_INPUT_ATTACHMENT,
+		ACCESS_SAMPLED,
+		ACCESS_STORAGE_READ,
+		ACCESS_STORAGE_WRITE,
+		ACCESS_INDIRECT_READ,
+		ACCESS_VERTEX_READ,
+		ACCESS_TRANSFER_READ,
+		ACCESS_TRANSFER_WRITE
+	};
+
+	struct ResourceUse {
+		uint32_t resource;
+		AccessType access;
+	};
+
+	struct AccessInfo {
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		VkImageUsageFlags usage;
+		bool write;
+		bool attachment;
+	};
+
+	struct PassContext {
+		VkCommandBuffer commandBuffer;
+		VkRenderPass renderPass;
+		uint32_t subpass;
+		VkFramebuffer framebuffer;
+		VkExtent2D extent;
+		uint32_t imageIndex;
+	};
+
+	struct Resource {
+		std::string name;
+		bool image;
+		// Imported resources live outside the graph and count as outputs.
+		bool imported;
+		VkFormat format;
+		VkImageAspectFlags aspect;
+		bool clear;
+		VkClearValue clearValue;
+		// Layout an imported image is left in at the end of the frame.
+		VkImageLayout finalLayout;
+		VkImageUsageFlags usage;
+		VkPipelineStageFlags stages;
+		bool transient;
+		// Drawn into the top-left part of the image only, as large as the extent passed to execute. The image itself
+		// keeps the full target extent.
+		bool dynamicExtent;
+		int firstStep;
+		int lastStep;
+	};
+
+	struct Pass {
+		std::string name;
+		bool graphics;
+		// Graphics passes that record their draws into secondary command buffers.
+		bool secondaryContents;
+		// Passes with effects outside the graph are never culled.
+		bool sideEffects;
+		std::vector<ResourceUse> uses;
+		std::function<void(const PassContext&)> record;
+	};
+
+	struct ImageBarrier {
+		uint32_t resource;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+	};
+
+	struct BarrierBatch {
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+		std::vector<ImageBarrier> imageBarriers;
+	};
+
+	// One render pass (possibly with several subpasses) or one compute/transfer pass.
+	struct Step {
+		std::string name;
+		bool graphics;
+		std::vector<uint32_t> passes;
+		BarrierBatch barriers;
+		VkRenderPass renderPass;
+		std::vector<uint32_t> attachments;
+		std::vector<VkClearValue> clearValues;
+		// Steps that write an imported image need one framebuffer per imported image.
+		bool perImageFramebuffers;
+		// Set when every attachment has a dynamic extent; the render area shrinks with it.
+		bool dynamicExtent;
+	};
+
+	// Tracks what has to happen before the next access to a resource.
+	struct ResourceState {
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages;
+		VkAccessFlags writeAccess;
+		VkPipelineStageFlags readStages;
+		// Stages and accesses already ordered after the last write, and reads not yet ordered before a future write.
+		VkPipelineStageFlags syncedStages;
+		VkAccessFlags syncedAccess;
+		VkPipelineStageFlags unsyncedReadStages;
+	};
+
+	// Everything that depends on the extent and the imported images; replaced wholesale on resize.
+	struct Targets {
+		VkExtent2D extent;
+		std::vector<VkImage> images;
+		std::vector<VkImageView> views;
+		std::vector<DeviceAllocation> allocations;
+		std::vector<std::vector<VkFramebuffer>> framebuffers;
+		std::vector<std::vector<VkImage>> importedImages;
+		std::vector<std::vector<VkImageView>> importedViews;
+		uint32_t aliasedImages;
+	};
+
+	static const VkAccessFlags WRITE_ACCESS_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	VkDevice device;
+	VkAllocationCallbacks* allocator;
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<Step> steps;
+	BarrierBatch finalBarriers;
+	uint32_t culledPasses;
+	uint32_t mergedPasses;
+
+	static RenderGraph create(VkDevice device, VkAllocationCallbacks* allocator) {
+		RenderGraph graph = {};
+		graph.device = device;
+		graph.allocator = allocator;
+		return graph;
+	}
+
+	uint32_t importImage(const std::string& name, VkFormat format, VkImageLayout finalLayout) {
+		Resource resource = {};
+		resource.name = name;
+		resource.image = true;
+		resource.imported = true;
+		resource.format = format;
+		resource.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+		resource.clear = true;
+		resource.finalLayout = finalLayout;
+		resources.push_back(resource);
+		return static_cast<uint32_t>(resources.size() - 1);
+	}
+
+	uint32_t createImage(const std::string& name, VkFormat format, VkImageAspectFlags aspect, const VkClearValue& clearValue) {
+		Resource resource = {};
+		resource.name = name;
+		resource.image = true;
+		resource.format = format;
+		resource.aspect = aspect;
+		resource.clear = true;
+		resource.clearValue = clearValue;
+		resources.push_back(resource);
+		return static_cast<uint32_t>(resources.size() - 1);
+	}
+
+	uint32_t importBuffer(const std::string& name) {
+		Resource resource = {};
+		resource.name = name;
+		resource.imported = true;
+		resources.push_back(resource);
+		return static_cast<uint32_t>(resources.size() - 1);
+	}
+
+	uint32_t addPass(const std::string& name, bool graphics, const std::vector<ResourceUse>& uses, std::function<void(const PassContext&)> record) {
+		Pass pass = {};
+		pass.name = name;
+		pass.graphics = graphics;
+		pass.uses = uses;
+		pass.record = record;
+		passes.push_back(pass);
+		return static_cast<uint32_t>(passes.size() - 1);
+	}
+
+	static AccessInfo describe(AccessType type, bool graphics) {
+		VkPipelineStageFlags shaderStages = graphics ? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		switch (type) {
+		case ACCESS_COLOR_ATTACHMENT:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true, true };
+		case ACCESS_DEPTH_ATTACHMENT:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true, true };
+		case ACCESS_INPUT_ATTACHMENT:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, false, true };
+		case ACCESS_SAMPLED:
+			return { graphics ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false, false };
+		case ACCESS_STORAGE_READ:
+			return { shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false, false };
+		case ACCESS_STORAGE_WRITE:
+			return { shaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true, false };
+		case ACCESS_INDIRECT_READ:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, false, false };
+		case ACCESS_VERTEX_READ:
+			return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, false, false };
+		case ACCESS_TRANSFER_READ:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, false };
+		case ACCESS_TRANSFER_WRITE:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true, false };
+		}
+		throw std::runtime_error("unknown render graph access type!");
+	}
+
+	AccessInfo describe(const Pass& pass, const ResourceUse& use) const {
+		return describe(use.access, pass.graphics);
+	}
+
+	bool dependsOn(const Pass& later, const Pass& earlier) const {
+		for (const auto& a : later.uses) {
+			for (const auto& b : earlier.uses) {
+				if (a.resource == b.resource && (describe(later, a).write || describe(earlier, b).write)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// A pass joins the previous render pass as another subpass only if everything it needs from that render pass is
+	// an attachment it reads or writes in place.
+	bool canMerge(const Step& step, const Pass& pass) const {
+		if (!step.graphics || !pass.graphics) {
+			return false;
+		}
+		for (const auto& use : pass.uses) {
+			for (uint32_t p : step.passes) {
+				for (const auto& earlier : passes[p].uses) {
+					if (earlier.resource != use.resource || !(describe(passes[p], earlier).write || describe(pass, use).write)) {
+						continue;
+					}
+					if (!describe(pass, use).attachment || !describe(passes[p], earlier).attachment) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	void access(ResourceState& state, const AccessInfo& info, uint32_t resource, BarrierBatch& batch) {
+		bool image = resources[resource].image;
+		if (image && state.layout != info.layout) {
+			VkPipelineStageFlags src = state.writeStages | state.readStages;
+			batch.srcStages |= src != 0 ? src : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			batch.dstStages |= info.stages;
+			batch.imageBarriers.push_back({ resource, state.layout, info.layout, state.writeAccess, info.access });
+			// The transition itself is a write that completes before the destination stages.
+			state.layout = info.layout;
+			state.writeStages = info.stages;
+			state.writeAccess = info.write ? (info.access & WRITE_ACCESS_MASK) : 0;
+			state.readStages = info.write ? 0 : info.stages;
+			state.syncedStages = info.write ? 0 : info.stages;
+			state.syncedAccess = info.write ? 0 : info.access;
+			state.unsyncedReadStages = state.readStages;
+			return;
+		}
+		if (info.write) {
+			bool covered = (info.stages & ~state.syncedStages) == 0 && state.unsyncedReadStages == 0;
+			VkPipelineStageFlags src = state.writeStages | state.readStages;
+			if (src != 0 && !covered) {
+				batch.srcStages |= src;
+				batch.dstStages |= info.stages;
+				batch.srcAccess |= state.writeAccess;
+				batch.dstAccess |= info.access;
+			}
+			state.writeStages = info.stages;
+			state.writeAccess = info.access & WRITE_ACCESS_MASK;
+			state.readStages = 0;
+			state.syncedStages = 0;
+			state.syncedAccess = 0;
+			state.unsyncedReadStages = 0;
+			return;
+		}
+		bool visible = (info.stages & ~state.syncedStages) == 0 && (info.access & ~state.syncedAccess) == 0;
+		if (state.writeStages != 0 && !visible) {
+			batch.srcStages |= state.writeStages;
+			batch.dstStages |= info.stages;
+			batch.srcAccess |= state.writeAccess;
+			batch.dstAccess |= info.access;
+			state.syncedStages |= info.stages;
+			state.syncedAccess |= info.access;
+		}
+		state.readStages |= info.stages;
+		state.unsyncedReadStages |= info.stages;
+	}
+
+	// Finds the first use of a resource after a step, if any.
+	bool nextUse(uint32_t resource, size_t afterStep, AccessInfo& info) const {
+		for (size_t s = afterStep + 1; s < steps.size(); s++) {
+			for (uint32_t p : steps[s].passes) {
+				for (const auto& use : passes[p].uses) {
+					if (use.resource == resource) {
+						info = describe(passes[p], use);
+						return true;
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+	void compile() {
+		// Cull: walk backwards from the outputs, keeping a pass if it writes something a later live pass reads.
+		std::vector<bool> live(passes.size(), false);
+		std::vector<bool> needed(resources.size(), false);
+		for (size_t p = passes.size(); p-- > 0;) {
+			const Pass& pass = passes[p];
+			bool keep = pass.sideEffects;
+			for (const auto& use : pass.uses) {
+				if (describe(pass, use).write && (resources[use.resource].imported || needed[use.resource])) {
+					keep = true;
+				}
+			}
+			if (!keep) {
+				continue;
+			}
+			live[p] = true;
+			for (const auto& use : pass.uses) {
+				AccessInfo info = describe(pass, use);
+				if (info.write && !(info.attachment && !resources[use.resource].clear)) {
+					needed[use.resource] = false;
+				}
+			}
+			for (const auto& use : pass.uses) {
+				AccessInfo info = describe(pass, use);
+				if (!info.write || (info.attachment && !resources[use.resource].clear)) {
+					needed[use.resource] = true;
+				}
+			}
+		}
+		culledPasses = static_cast<uint32_t>(std::count(live.begin(), live.end(), false));
+
+		// Order: a stable topological sort of the live passes that keeps mergeable graphics passes adjacent.
+		std::vector<uint32_t> order;
+		std::vector<bool> scheduled(passes.size(), false);
+		size_t liveCount = passes.size() - culledPasses;
+		while (order.size() < liveCount) {
+			int choice = -1;
+			for (uint32_t p = 0; p < passes.size(); p++) {
+				if (!live[p] || scheduled[p]) {
+					continue;
+				}
+				bool ready = true;
+				for (uint32_t q = 0; q < p && ready; q++) {
+					ready = !live[q] || scheduled[q] || !dependsOn(passes[p], passes[q]);
+				}
+				if (!ready) {
+					continue;
+				}
+				if (choice < 0) {
+					choice = p;
+				}
+				if (!steps.empty() && canMerge(steps.back(), passes[p])) {
+					choice = p;
+					break;
+				}
+			}
+			scheduled[choice] = true;
+			order.push_back(choice);
+
+			const Pass& pass = passes[choice];
+			if (!steps.empty() && canMerge(steps.back(), pass)) {
+				steps.back().passes.push_back(choice);
+				steps.back().name += "+" + pass.name;
+				mergedPasses++;
+				continue;
+			}
+			Step step = {};
+			step.name = pass.name;
+			step.graphics = pass.graphics;
+			step.passes.push_back(choice);
+			steps.push_back(step);
+		}
+
+		for (auto& resource : resources) {
+			resource.firstStep = -1;
+			resource.lastStep = -1;
+		}
+		for (size_t s = 0; s < steps.size(); s++) {
+			for (uint32_t p : steps[s].passes) {
+				for (const auto& use : passes[p].uses) {
+					Resource& resource = resources[use.resource];
+					AccessInfo info = describe(passes[p], use);
+					resource.usage |= info.usage;
+					resource.stages |= info.stages;
+					if (resource.firstStep < 0) {
+						resource.firstStep = static_cast<int>(s);
+					}
+					resource.lastStep = static_cast<int>(s);
+				}
+			}
+		}
+
+		// Images that never leave a single render pass as attachments need no backing store of their own.
+		VkPipelineStageFlags internalImageStages = 0;
+		for (uint32_t r = 0; r < resources.size(); r++) {
+			Resource& resource = resources[r];
+			if (!resource.image || resource.imported || resource.firstStep < 0) {
+				continue;
+			}
+			internalImageStages |= resource.stages;
+			bool attachmentsOnly = resource.firstStep == resource.lastStep && steps[resource.firstStep].graphics;
+			for (uint32_t p : steps[resource.firstStep].passes) {
+				for (const auto& use : passes[p].uses) {
+					if (use.resource == r && !describe(passes[p], use).attachment) {
+						attachmentsOnly = false;
+					}
+				}
+			}
+			if (attachmentsOnly) {
+				resource.transient = true;
+				resource.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			}
+		}
+
+		// Internal images may share memory and every frame reuses them, so their first access waits on every stage that
+		// touches any of them. Imported images are handed over by the acquire semaphore wait.
+		std::vector<ResourceState> states(resources.size());
+		for (uint32_t r = 0; r < resources.size(); r++) {
+			ResourceState& state = states[r];
+			state = {};
+			state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (resources[r].image) {
+				state.readStages = resources[r].imported ? VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT : internalImageStages;
+				state.unsyncedReadStages = state.readStages;
+			}
+		}
+
+		for (size_t s = 0; s < steps.size(); s++) {
+			Step& step = steps[s];
+			if (!step.graphics) {
+				const Pass& pass = passes[step.passes[0]];
+				for (const auto& use : pass.uses) {
+					access(states[use.resource], describe(pass, use), use.resource, step.barriers);
+				}
+				continue;
+			}
+			for (uint32_t p : step.passes) {
+				for (const auto& use : passes[p].uses) {
+					if (!describe(passes[p], use).attachment) {
+						access(states[use.resource], describe(passes[p], use), use.resource, step.barriers);
+					}
+					else if (std::find(step.attachments.begin(), step.attachments.end(), use.resource) == step.attachments.end()) {
+						step.attachments.push_back(use.resource);
+					}
+				}
+			}
+			createRenderPass(s, states);
+		}
+
+		for (uint32_t r = 0; r < resources.size(); r++) {
+			const Resource& resource = resources[r];
+			ResourceState& state = states[r];
+			if (resource.image && resource.imported && resource.firstStep >= 0 && state.layout != resource.finalLayout) {
+				VkPipelineStageFlags src = state.writeStages | state.readStages;
+				finalBarriers.srcStages |= src != 0 ? src : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+				finalBarriers.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+				finalBarriers.imageBarriers.push_back({ r, state.layout, resource.finalLayout, state.writeAccess, 0 });
+			}
+		}
+	}
+
+	// Attachment hazards inside a render pass become subpass dependencies instead of pipeline barriers. Each attachment
+	// is left in the layout of its next use so the following step needs no transition.
+	void createRenderPass(size_t stepIndex, std::vector<ResourceState>& states) {
+		Step& step = steps[stepIndex];
+		std::vector<VkAttachmentDescription> attachments;
+		std::vector<VkSubpassDependency> dependencies;
+		std::vector<std::vector<VkAttachmentReference>> colorRefs(step.passes.size());
+		std::vector<std::vector<VkAttachmentReference>> inputRefs(step.passes.size());
+		std::vector<VkAttachmentReference> depthRefs(step.passes.size(), { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+		std::vector<std::vector<uint32_t>> preserveRefs(step.passes.size());
+
+		step.dynamicExtent = !step.attachments.empty();
+		for (uint32_t a = 0; a < step.attachments.size(); a++) {
+			uint32_t r = step.attachments[a];
+			const Resource& resource = resources[r];
+			ResourceState& state = states[r];
+			if (resource.imported) {
+				step.perImageFramebuffers = true;
+			}
+			step.dynamicExtent = step.dynamicExtent && resource.dynamicExtent;
+
+			int firstSubpass = -1;
+			int lastSubpass = -1;
+			AccessInfo first = {};
+			VkPipelineStageFlags stepStages = 0;
+			VkAccessFlags stepWrites = 0;
+			VkPipelineStageFlags stepReads = 0;
+			VkImageLayout lastLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			for (uint32_t i = 0; i < step.passes.size(); i++) {
+				const Pass& pass = passes[step.passes[i]];
+				for (const auto& use : pass.uses) {
+					if (use.resource != r) {
+						continue;
+					}
+					AccessInfo info = describe(pass, use);
+					if (firstSubpass < 0) {
+						firstSubpass = i;
+						first = info;
+					}
+					else if (lastSubpass != static_cast<int>(i)) {
+						// Successive subpasses touching the same attachment are ordered by region.
+						VkSubpassDependency dependency = {};
+						dependency.srcSubpass = lastSubpass;
+						dependency.dstSubpass = i;
+						dependency.srcStageMask = stepStages;
+						dependency.srcAccessMask = stepWrites;
+						dependency.dstStageMask = info.stages;
+						dependency.dstAccessMask = info.access;
+						dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+						dependencies.push_back(dependency);
+					}
+					lastSubpass = i;
+					lastLayout = info.layout;
+					stepStages |= info.stages;
+					if (info.write) {
+						stepWrites |= info.access & WRITE_ACCESS_MASK;
+					}
+					else {
+						stepReads |= info.stages;
+					}
+					VkAttachmentReference ref = { a, info.layout };
+					if (use.access == ACCESS_COLOR_ATTACHMENT) {
+						colorRefs[i].push_back(ref);
+					}
+					else if (use.access == ACCESS_DEPTH_ATTACHMENT) {
+						depthRefs[i] = ref;
+					}
+					else {
+						inputRefs[i].push_back(ref);
+					}
+				}
+			}
+			for (int i = firstSubpass + 1; i < lastSubpass; i++) {
+				bool used = false;
+				for (const auto& use : passes[step.passes[i]].uses) {
+					used = used || use.resource == r;
+				}
+				if (!used) {
+					preserveRefs[i].push_back(a);
+				}
+			}
+
+			AccessInfo next = {};
+			bool hasNext = nextUse(r, stepIndex, next);
+			bool hasContent = state.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+
+			VkAttachmentDescription description = {};
+			description.format = resource.format;
+			description.samples = VK_SAMPLE_COUNT_1_BIT;
+			description.loadOp = hasContent ? VK_ATTACHMENT_LOAD_OP_LOAD : (first.write && resource.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+			description.storeOp = hasNext || resource.imported ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			description.stencilLoadOp = (resource.aspect & VK_IMAGE_ASPECT_STENCIL_BIT) ? description.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			description.stencilStoreOp = (resource.aspect & VK_IMAGE_ASPECT_STENCIL_BIT) ? description.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			description.initialLayout = hasContent ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+			description.finalLayout = hasNext ? next.layout : (resource.imported ? resource.finalLayout : lastLayout);
+			attachments.push_back(description);
+			step.clearValues.push_back(resource.clearValue);
+
+			VkSubpassDependency entry = {};
+			entry.srcSubpass = VK_SUBPASS_EXTERNAL;
+			entry.dstSubpass = firstSubpass;
+			entry.srcStageMask = state.writeStages | state.readStages;
+			if (entry.srcStageMask == 0) {
+				entry.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			}
+			entry.srcAccessMask = state.writeAccess;
+			entry.dstStageMask = first.stages;
+			entry.dstAccessMask = first.access;
+			dependencies.push_back(entry);
+
+			VkSubpassDependency exit = {};
+			exit.srcSubpass = lastSubpass;
+			exit.dstSubpass = VK_SUBPASS_EXTERNAL;
+			exit.srcStageMask = stepStages;
+			exit.srcAccessMask = stepWrites;
+			exit.dstStageMask = hasNext ? next.stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+			exit.dstAccessMask = hasNext ? next.access : 0;
+			dependencies.push_back(exit);
+
+			state.layout = description.finalLayout;
+			state.writeStages = stepWrites != 0 ? stepStages : 0;
+			state.writeAccess = stepWrites;
+			state.readStages = stepReads;
+			state.syncedStages = hasNext ? next.stages : 0;
+			state.syncedAccess = hasNext ? next.access : 0;
+			state.unsyncedReadStages = hasNext ? 0 : stepReads;
+		}
+
+		std::vector<VkSubpassDescription> subpasses(step.passes.size());
+		for (uint32_t i = 0; i < step.passes.size(); i++) {
+			VkSubpassDescription& subpass = subpasses[i];
+			subpass = {};
+			subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs[i].size());
+			subpass.pColorAttachments = colorRefs[i].data();
+			subpass.inputAttachmentCount = static_cast<uint32_t>(inputRefs[i].size());
+			subpass.pInputAttachments = inputRefs[i].data();
+			subpass.pDepthStencilAttachment = depthRefs[i].attachment != VK_ATTACHMENT_UNUSED ? &depthRefs[i] : nullptr;
+			subpass.preserveAttachmentCount = static_cast<uint32_t>(preserveRefs[i].size());
+			subpass.pPreserveAttachments = preserveRefs[i].data();
+		}
+
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+		renderPassInfo.pSubpasses = subpasses.data();
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+
+		if (vkCreateRenderPass(device, &renderPassInfo, allocator, &step.renderPass) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create render pass!");
+		}
+	}
+
+	// Render pass and subpass a graphics pass was compiled into, for pipeline creation.
+	VkRenderPass renderPassFor(uint32_t pass, uint32_t& subpass) const {
+		for (const auto& step : steps) {
+			for (uint32_t i = 0; i < step.passes.size(); i++) {
+				if (step.passes[i] == pass) {
+					subpass = i;
+					return step.renderPass;
+				}
+			}
+		}
+		throw std::runtime_error("render graph pass was culled!");
+	}
+
+	void bindImported(Targets& targets, uint32_t resource, const std::vector<VkImage>& images, const std::vector<VkImageView>& views) {
+		targets.importedImages.resize(resources.size());
+		targets.importedViews.resize(resources.size());
+		targets.importedImages[resource] = images;
+		targets.importedViews[resource] = views;
+	}
+
+	VkImageView imageView(const Targets& targets, uint32_t resource, uint32_t imageIndex) const {
+		return resources[resource].imported ? targets.importedViews[resource][imageIndex] : targets.views[resource];
+	}
+
+	// Creates the internal images and framebuffers of one output for an extent. Call bindImported first; the previous
+	// targets are overwritten, so hand them to destroyTargets once no frame in flight uses them.
+	void realize(DeviceMemoryAllocator& memoryAllocator, Targets& targets, VkExtent2D extent) {
+		targets.extent = extent;
+		targets.images.assign(resources.size(), VK_NULL_HANDLE);
+		targets.views.assign(resources.size(), VK_NULL_HANDLE);
+		targets.allocations.clear();
+		targets.framebuffers.assign(steps.size(), std::vector<VkFramebuffer>());
+		targets.importedImages.resize(resources.size());
+		targets.importedViews.resize(resources.size());
+		targets.aliasedImages = 0;
+
+		// Non-transient images are packed first-fit into slots whose occupants have disjoint step lifetimes.
+		struct Slot {
+			VkMemoryRequirements requirements;
+			std::vector<uint32_t> members;
+		};
+		std::vector<Slot> slots;
+		for (uint32_t r = 0; r < resources.size(); r++) {
+			const Resource& resource = resources[r];
+			if (!resource.image || resource.imported || resource.firstStep < 0) {
+				continue;
+			}
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = resource.format;
+			imageInfo.extent = { extent.width, extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = resource.usage;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			if (resource.transient) {
+				targets.allocations.push_back(memoryAllocator.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, targets.images[r]));
+				continue;
+			}
+			if (vkCreateImage(device, &imageInfo, allocator, &targets.images[r]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create image!");
+			}
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(device, targets.images[r], &requirements);
+			Slot* slot = nullptr;
+			for (auto& candidate : slots) {
+				bool disjoint = (candidate.requirements.memoryTypeBits & requirements.memoryTypeBits) != 0;
+				for (uint32_t member : candidate.members) {
+					disjoint = disjoint && (resources[member].lastStep < resource.firstStep || resource.lastStep < resources[member].firstStep);
+				}
+				if (disjoint) {
+					slot = &candidate;
+					break;
+				}
+			}
+			if (slot == nullptr) {
+				slots.push_back({ requirements, {} });
+				slot = &slots.back();
+			}
+			else {
+				slot->requirements.size = std::max(slot->requirements.size, requirements.size);
+				slot->requirements.alignment = std::max(slot->requirements.alignment, requirements.alignment);
+				slot->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+				targets.aliasedImages++;
+			}
+			slot->members.push_back(r);
+		}
+		for (const auto& slot : slots) {
+			DeviceAllocation allocation = memoryAllocator.allocate(slot.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, true);
+			for (uint32_t member : slot.members) {
+				vkBindImageMemory(device, targets.images[member], allocation.memory, allocation.offset);
+			}
+			targets.allocations.push_back(allocation);
+		}
+
+		for (uint32_t r = 0; r < resources.size(); r++) {
+			if (targets.images[r] == VK_NULL_HANDLE) {
+				continue;
+			}
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = targets.images[r];
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = resources[r].format;
+			viewInfo.subresourceRange.aspectMask = resources[r].aspect;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.layerCount = 1;
+			if (vkCreateImageView(device, &viewInfo, allocator, &targets.views[r]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create image views!");
+			}
+		}
+
+		for (size_t s = 0; s < steps.size(); s++) {
+			const Step& step = steps[s];
+			if (!step.graphics) {
+				continue;
+			}
+			size_t framebufferCount = 1;
+			for (uint32_t r : step.attachments) {
+				if (resources[r].imported) {
+					framebufferCount = targets.importedViews[r].size();
+				}
+			}
+			for (uint32_t i = 0; i < framebufferCount; i++) {
+				std::vector<VkImageView> views;
+				for (uint32_t r : step.attachments) {
+					views.push_back(imageView(targets, r, i));
+				}
+				VkFramebufferCreateInfo framebufferInfo = {};
+				framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+				framebufferInfo.renderPass = step.renderPass;
+				framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+				framebufferInfo.pAttachments = views.data();
+				framebufferInfo.width = extent.width;
+				framebufferInfo.height = extent.height;
+				framebufferInfo.layers = 1;
+
+				VkFramebuffer framebuffer;
+				if (vkCreateFramebuffer(device, &framebufferInfo, allocator, &framebuffer) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create framebuffer!");
+				}
+				targets.framebuffers[s].push_back(framebuffer);
+			}
+		}
+	}
+
+	void destroyTargets(DeviceMemoryAllocator& memoryAllocator, Targets& old) {
+		for (auto& framebuffers : old.framebuffers) {
+			for (VkFramebuffer framebuffer : framebuffers) {
+				vkDestroyFramebuffer(device, framebuffer, allocator);
+			}
+		}
+		for (size_t r = 0; r < old.images.size(); r++) {
+			if (old.views[r] != VK_NULL_HANDLE) {
+				vkDestroyImageView(device, old.views[r], allocator);
+			}
+			if (old.images[r] != VK_NULL_HANDLE) {
+				vkDestroyImage(device, old.images[r], allocator);
+			}
+		}
+		for (const auto& allocation : old.allocations) {
+			memoryAllocator.free(allocation);
+		}
+		old = {};
+	}
+
+	void recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch, const Targets& targets, uint32_t imageIndex) const {
+		if (batch.srcStages == 0) {
+			return;
+		}
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = batch.srcAccess;
+		memoryBarrier.dstAccessMask = batch.dstAccess;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		for (const auto& barrier : batch.imageBarriers) {
+			const Resource& resource = resources[barrier.resource];
+			VkImageMemoryBarrier imageBarrier = {};
+			imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			imageBarrier.srcAccessMask = barrier.srcAccess;
+			imageBarrier.dstAccessMask = barrier.dstAccess;
+			imageBarrier.oldLayout = barrier.oldLayout;
+			imageBarrier.newLayout = barrier.newLayout;
+			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.image = resource.imported ? targets.importedImages[barrier.resource][imageIndex] : targets.images[barrier.resource];
+			imageBarrier.subresourceRange.aspectMask = resource.aspect;
+			imageBarrier.subresourceRange.levelCount = 1;
+			imageBarrier.subresourceRange.layerCount = 1;
+			imageBarriers.push_back(imageBarrier);
+		}
+		bool memory = batch.srcAccess != 0 || batch.dstAccess != 0;
+		vkCmdPipelineBarrier(commandBuffer, batch.srcStages, batch.dstStages, 0, memory ? 1 : 0, &memoryBarrier, 0, nullptr,
+			static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+
+	// dynamicExtent must not exceed targets.extent; it is what passes drawing only to dynamic extent resources see.
+	void execute(VkCommandBuffer commandBuffer, const Targets& targets, uint32_t imageIndex, VkExtent2D dynamicExtent, GpuProfiler& profiler) {
+		for (size_t s = 0; s < steps.size(); s++) {
+			const Step& step = steps[s];
+			recordBarriers(commandBuffer, step.barriers, targets, imageIndex);
+			uint32_t scope = profiler.beginScope(commandBuffer, step.name);
+			PassContext ctx = { commandBuffer, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, step.dynamicExtent ? dynamicExtent : targets.extent, imageIndex };
+			if (!step.graphics) {
+				passes[step.passes[0]].record(ctx);
+				profiler.endScope(commandBuffer, scope);
+				continue;
+			}
+			ctx.renderPass = step.renderPass;
+			ctx.framebuffer = targets.framebuffers[s][step.perImageFramebuffers ? imageIndex : 0];
+
+			VkRenderPassBeginInfo renderPassInfo = {};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			renderPassInfo.renderPass = step.renderPass;
+			renderPassInfo.framebuffer = ctx.framebuffer;
+			renderPassInfo.renderArea.offset = { 0, 0 };
+			renderPassInfo.renderArea.extent = ctx.extent;
+			renderPassInfo.clearValueCount = static_cast<uint32_t>(step.clearValues.size());
+			renderPassInfo.pClearValues = step.clearValues.data();
+
+			for (uint32_t i = 0; i < step.passes.size(); i++) {
+				const Pass& pass = passes[step.passes[i]];
+				VkSubpassContents contents = pass.secondaryContents ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+				if (i == 0) {
+					vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+				}
+				else {
+					vkCmdNextSubpass(commandBuffer, contents);
+				}
+				ctx.subpass = i;
+				pass.record(ctx);
+			}
+			vkCmdEndRenderPass(commandBuffer);
+			profiler.endScope(commandBuffer, scope);
+		}
+		recordBarriers(commandBuffer, finalBarriers, targets, imageIndex);
+	}
+
+	void printSummary(const Targets& targets) const {
+		std::cout << "Render graph: " << steps.size() << " steps from " << passes.size() << " passes (" << culledPasses << " culled, "
+			<< mergedPasses << " merged into subpasses)" << std::endl;
+		for (const auto& step : steps) {
+			std::cout << "\t" << step.name << (step.graphics ? " [render pass]" : "") << std::endl;
+		}
+		for (const auto& resource : resources) {
+			if (resource.image && !resource.imported && resource.firstStep >= 0) {
+				std::cout << "\t" << resource.name << ": " << (resource.transient ? "transient" : "persistent")
+					<< (resource.dynamicExtent ? ", dynamic extent" : "") << ", steps " << resource.firstStep << "-" << resource.lastStep << std::endl;
+			}
+		}
+		if (targets.aliasedImages > 0) {
+			std::cout << "\t" << targets.aliasedImages << " images alias memory" << std::endl;
+		}
+	}
+
+	void destroy() {
+		for (const auto& step : steps) {
+			if (step.renderPass != VK_NULL_HANDLE) {
+				vkDestroyRenderPass(device, step.renderPass, allocator);
+			}
+		}
+	}
+};
+
+// Copies every presented image into a ring of host-visible readback buffers and streams the frames to disk on a writer
+// thread. A slot is handed to the writer once the graphics timeline has passed the submission that filled it; the frame
+// loop only polls after its own frame wait, so capture never adds a stall. When the writer falls behind and
+// no slot is free, the frame is dropped rather than waiting on file I/O.
+struct FrameCapture {
+	enum Format {
+		// A YUV 4:4:4 stream that encoders read directly.
+		FORMAT_Y4M,
+		// Tightly packed RGBA8 frames back to back.
+		FORMAT_RAW,
+		// One uncompressed PNG per frame, for golden images.
+		FORMAT_PNG
+	};
+
+	enum SlotState {
+		SLOT_FREE,
+		SLOT_PENDING,
+		SLOT_WRITING
+	};
+
+	struct Slot {
+		VkBuffer buffer;
+		DeviceAllocation allocation;
+		VkDeviceSize capacity;
+		VkExtent2D extent;
+		SubmissionScheduler::SyncPoint point;
+		uint64_t frame;
+		SlotState state;
+	};
+
+	static const uint32_t FRAME_RATE = 60;
+
+	VkDevice device;
+	Format format;
+	std::string path;
+	bool bgra;
+	std::vector<Slot> slots;
+	uint32_t nextSlot = 0;
+	uint64_t frameNumber = 0;
+	// Stream formats cannot change size, so they keep the extent of the first captured frame.
+	VkExtent2D streamExtent = {};
+	std::ofstream stream;
+	bool streamHeaderWritten = false;
+	std::thread writerThread;
+	std::mutex mutex;
+	std::condition_variable writeCondition;
+	std::deque<uint32_t> writeQueue;
+	bool stopping = false;
+	uint64_t written = 0;
+	uint64_t dropped = 0;
+	uint64_t skipped = 0;
+	uint64_t writeFailures = 0;
+
+	static Format formatForPath(const std::string& path) {
+		auto endsWith = [&](const char* suffix) {
+			size_t length = strlen(suffix);
+			return path.size() >= length && path.compare(path.size() - length, length, suffix) == 0;
+		};
+		if (endsWith(".y4m")) {
+			return FORMAT_Y4M;
+		}
+		if (endsWith(".png")) {
+			return FORMAT_PNG;
+		}
+		return FORMAT_RAW;
+	}
+
+	void start(VkDevice device, const std::string& path, VkFormat imageFormat, uint32_t slotCount) {
+		this->device = device;
+		this->path = path;
+		format = formatForPath(path);
+		if (imageFormat == VK_FORMAT_B8G8R8A8_UNORM || imageFormat == VK_FORMAT_B8G8R8A8_SRGB) {
+			bgra = true;
+		}
+		else if (imageFormat == VK_FORMAT_R8G8B8A8_UNORM || imageFormat == VK_FORMAT_R8G8B8A8_SRGB) {
+			bgra = false;
+		}
+		else {
+			throw std::runtime_error("frame capture only supports 8-bit RGBA and BGRA images!");
+		}
+		if (format != FORMAT_PNG) {
+			stream.open(path, std::ios::binary);
+			if (!stream) {
+				throw std::runtime_error("failed to open capture file " + path + "!");
+			}
+		}
+		slots.assign(slotCount, Slot());
+		stopping = false;
+		writerThread = std::thread(&FrameCapture::writeLoop, this);
+	}
+
+	// Hands over the frames still on the GPU, which must be idle, and waits for the writer to finish them.
+	void stop(DeviceMemoryAllocator& memoryAllocator, SubmissionScheduler& scheduler) {
+		if (!writerThread.joinable()) {
+			return;
+		}
+		poll(scheduler);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		writeCondition.notify_one();
+		writerThread.join();
+		stream.close();
+		for (auto& slot : slots) {
+			if (slot.buffer != VK_NULL_HANDLE) {
+				memoryAllocator.destroyBuffer(slot.buffer, slot.allocation);
+			}
+		}
+		slots.clear();
+
+		std::cout << "Captured " << written << " frames to " << path << " (" << dropped << " dropped because the writer fell behind";
+		if (skipped > 0) {
+			std::cout << ", " << skipped << " skipped after a resize";
+		}
+		std::cout << ")" << std::endl;
+		if (format == FORMAT_RAW && written > 0) {
+			std::cout << "\traw rgba frames at " << streamExtent.width << "x" << streamExtent.height << std::endl;
+		}
+		if (writeFailures > 0) {
+			std::cerr << "failed to write " << writeFailures << " captured frames!" << std::endl;
+		}
+	}
+
+	// Records the copy of image into a free readback buffer; point is the one the frame is about to be submitted with.
+	// Returns false if the frame was dropped.
+	bool record(VkCommandBuffer commandBuffer, DeviceMemoryAllocator& memoryAllocator, VkImage image, VkExtent2D extent,
+		SubmissionScheduler::SyncPoint point) {
+		frameNumber++;
+		if (format != FORMAT_PNG) {
+			if (streamExtent.width == 0) {
+				streamExtent = extent;
+			}
+			if (extent.width != streamExtent.width || extent.height != streamExtent.height) {
+				skipped++;
+				return false;
+			}
+		}
+
+		Slot* slot = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (slots[nextSlot].state == SLOT_FREE) {
+				slot = &slots[nextSlot];
+				slot->state = SLOT_PENDING;
+				nextSlot = (nextSlot + 1) % slots.size();
+			}
+		}
+		if (slot == nullptr) {
+			if (dropped++ == 0) {
+				std::cerr << "capture writer is falling behind; dropping frames" << std::endl;
+			}
+			return false;
+		}
+
+		VkDeviceSize size = VkDeviceSize(extent.width) * extent.height * 4;
+		if (slot->capacity < size) {
+			if (slot->buffer != VK_NULL_HANDLE) {
+				memoryAllocator.destroyBuffer(slot->buffer, slot->allocation);
+			}
+			slot->allocation = memoryAllocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, slot->buffer);
+			slot->capacity = size;
+		}
+		slot->extent = extent;
+		slot->point = point;
+		slot->frame = frameNumber;
+
+		VkBufferImageCopy region = {};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { extent.width, extent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = slot->buffer;
+		barrier.offset = 0;
+		barrier.size = size;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		return true;
+	}
+
+	// Queues every slot whose frame has completed.
+	void poll(SubmissionScheduler& scheduler) {
+		bool queued = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (uint32_t i = 0; i < slots.size(); i++) {
+				if (slots[i].state == SLOT_PENDING && scheduler.isComplete(slots[i].point)) {
+					slots[i].state = SLOT_WRITING;
+					writeQueue.push_back(i);
+					queued = true;
+				}
+			}
+			// Slots complete in submission order; keep the writer in that order too.
+			std::sort(writeQueue.begin(), writeQueue.end(), [this](uint32_t a, uint32_t b) { return slots[a].frame < slots[b].frame; });
+		}
+		if (queued) {
+			writeCondition.notify_one();
+		}
+	}
+
+	void writeLoop() {
+		std::vector<unsigned char> scratch;
+		for (;;) {
+			uint32_t index;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				writeCondition.wait(lock, [this] { return stopping || !writeQueue.empty(); });
+				if (writeQueue.empty()) {
+					return;
+				}
+				index = writeQueue.front();
+				writeQueue.pop_front();
+			}
+			// The slot is not touched by the frame loop while it is SLOT_WRITING.
+			const Slot& slot = slots[index];
+			bool ok = writeFrame(static_cast<const unsigned char*>(slot.allocation.mapped), slot.extent, slot.frame, scratch);
+			std::lock_guard<std::mutex> lock(mutex);
+			slots[index].state = SLOT_FREE;
+			if (ok) {
+				written++;
+			}
+			else {
+				writeFailures++;
+			}
+		}
+	}
+
+	bool writeFrame(const unsigned char* pixels, VkExtent2D extent, uint64_t frame, std::vector<unsigned char>& scratch) {
+		size_t pixelCount = size_t(extent.width) * extent.height;
+		int r = bgra ? 2 : 0;
+		int b = bgra ? 0 : 2;
+		if (format == FORMAT_Y4M) {
+			if (!streamHeaderWritten) {
+				streamHeaderWritten = true;
+				stream << "YUV4MPEG2 W" << extent.width << " H" << extent.height << " F" << FRAME_RATE << ":1 Ip A1:1 C444\n";
+			}
+			// BT.601 studio range.
+			scratch.resize(pixelCount * 3);
+			unsigned char* y = scratch.data();
+			unsigned char* u = y + pixelCount;
+			unsigned char* v = u + pixelCount;
+			for (size_t i = 0; i < pixelCount; i++) {
+				int red = pixels[i * 4 + r];
+				int green = pixels[i * 4 + 1];
+				int blue = pixels[i * 4 + b];
+				y[i] = static_cast<unsigned char>(((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16);
+				u[i] = static_cast<unsigned char>(((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128);
+				v[i] = static_cast<unsigned char>(((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128);
+			}
+			stream << "FRAME\n";
+			stream.write(reinterpret_cast<const char*>(scratch.data()), scratch.size());
+			return bool(stream);
+		}
+		if (format == FORMAT_RAW) {
+			if (!bgra) {
+				stream.write(reinterpret_cast<const char*>(pixels), pixelCount * 4);
+				return bool(stream);
+			}
+			scratch.resize(pixelCount * 4);
+			for (size_t i = 0; i < pixelCount; i++) {
+				scratch[i * 4 + 0] = pixels[i * 4 + 2];
+				scratch[i * 4 + 1] = pixels[i * 4 + 1];
+				scratch[i * 4 + 2] = pixels[i * 4 + 0];
+				scratch[i * 4 + 3] = pixels[i * 4 + 3];
+			}
+			stream.write(reinterpret_cast<const char*>(scratch.data()), scratch.size());
+			return bool(stream);
+		}
+
+		// Filter-free RGB scanlines wrapped in stored deflate blocks, which needs no compression library.
+		size_t rowSize = size_t(extent.width) * 3 + 1;
+		std::vector<unsigned char> rows(rowSize * extent.height);
+		for (uint32_t row = 0; row < extent.height; row++) {
+			unsigned char* out = &rows[row * rowSize];
+			*out++ = 0;
+			const unsigned char* in = pixels + size_t(row) * extent.width * 4;
+			for (uint32_t x = 0; x < extent.width; x++, in += 4) {
+				*out++ = in[r];
+				*out++ = in[1];
+				*out++ = in[b];
+			}
+		}
+		scratch.clear();
+		scratch.push_back(0x78);
+		scratch.push_back(0x01);
+		uint32_t adlerA = 1, adlerB = 0;
+		for (size_t offset = 0; offset < rows.size(); offset += 65535) {
+			size_t length = std::min(rows.size() - offset, size_t(65535));
+			scratch.push_back(offset + length == rows.size() ? 1 : 0);
+			scratch.push_back(length & 0xff);
+			scratch.push_back((length >> 8) & 0xff);
+			scratch.push_back(~length & 0xff);
+			scratch.push_back((~length >> 8) & 0xff);
+			scratch.insert(scratch.end(), rows.begin() + offset, rows.begin() + offset + length);
+			for (size_t i = offset; i < offset + length; i++) {
+				adlerA = (adlerA + rows[i]) % 65521;
+				adlerB = (adlerB + adlerA) % 65521;
+			}
+		}
+		appendBigEndian(scratch, (adlerB << 16) | adlerA);
+
+		std::string framePath = path.substr(0, path.size() - 4);
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_%06llu.png", static_cast<unsigned long long>(frame));
+		std::ofstream file(framePath + suffix, std::ios::binary);
+		static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+		std::vector<unsigned char> header;
+		appendBigEndian(header, extent.width);
+		appendBigEndian(header, extent.height);
+		header.insert(header.end(), { 8, 2, 0, 0, 0 });
+		writePngChunk(file, "IHDR", header);
+		writePngChunk(file, "IDAT", scratch);
+		writePngChunk(file, "IEND", std::vector<unsigned char>());
+		return bool(file);
+	}
+
+	static void appendBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			out.push_back((value >> shift) & 0xff);
+		}
+	}
+
+	static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+		static const std::array<uint32_t, 256> table = [] {
+			std::array<uint32_t, 256> entries;
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++) {
+					c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				entries[n] = c;
+			}
+			return entries;
+		}();
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++) {
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	static void writePngChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data) {
+		std::vector<unsigned char> prefix;
+		appendBigEndian(prefix, static_cast<uint32_t>(data.size()));
+		prefix.insert(prefix.end(), type, type + 4);
+		uint32_t crc = crc32(0, prefix.data() + 4, 4);
+		crc = crc32(crc, data.data(), data.size());
+		std::vector<unsigned char> suffix;
+		appendBigEndian(suffix, crc);
+		file.write(reinterpret_cast<const char*>(prefix.data()), prefix.size());
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+		file.write(reinterpret_cast<const char*>(suffix.data()), suffix.size());
+	}
+};
+
+// Validation messages are reported without blocking the driver threads that trigger them. The messenger callback only
+// copies the message into a slot of a bounded lock-free ring (dropping it if the ring is full); a background thread
+// drains the ring, folds repeats of a message into a count printed once a second, limits how often any one message ID
+// is printed and writes everything to stderr.
+struct ValidationLog {
+	enum Severity {
+		SEVERITY_VERBOSE,
+		SEVERITY_INFO,
+		SEVERITY_WARNING,
+		SEVERITY_ERROR
+	};
+
+	static const uint32_t RING_SIZE = 1024;
+	static const size_t MAX_MESSAGE_LENGTH = 2048;
+	static const uint32_t MESSAGES_PER_ID_PER_SECOND = 5;
+	// The dedupe table is cleared once it reaches this many distinct messages.
+	static const size_t MAX_DISTINCT_MESSAGES = 4096;
+
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		Severity severity;
+		int32_t messageId;
+		char text[MAX_MESSAGE_LENGTH];
+	};
+
+	struct IdWindow {
+		std::chrono::steady_clock::time_point start;
+		uint32_t printed;
+		uint64_t suppressed;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<uint64_t> enqueuePosition{ 0 };
+	uint64_t dequeuePosition = 0;
+	std::atomic<int> minimumSeverity{ SEVERITY_WARNING };
+	Severity subscribedSeverity = SEVERITY_WARNING;
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+	uint64_t duplicates = 0;
+	uint64_t rateLimited = 0;
+	std::thread drainThread;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+	std::atomic<bool> stopping{ false };
+	std::unordered_map<std::string, uint64_t> repeats;
+	std::unordered_map<int32_t, IdWindow> idWindows;
+	std::chrono::steady_clock::time_point lastRepeatFlush;
+	PFN_vkSetDebugUtilsObjectNameEXT setObjectName = nullptr;
+
+	static Severity severityFromName(const std::string& name) {
+		if (name == "verbose") {
+			return SEVERITY_VERBOSE;
+		}
+		else if (name == "info") {
+			return SEVERITY_INFO;
+		}
+		else if (name == "warning") {
+			return SEVERITY_WARNING;
+		}
+		else if (name == "error") {
+			return SEVERITY_ERROR;
+		}
+		throw std::runtime_error("unknown validation severity: " + name);
+	}
+
+	static const char* severityName(Severity severity) {
+		switch (severity) {
+		case SEVERITY_VERBOSE: return "verbose";
+		case SEVERITY_INFO: return "info";
+		case SEVERITY_WARNING: return "warning";
+		default: return "error";
+		}
+	}
+
+	static Severity severityFromFlags(VkDebugUtilsMessageSeverityFlagBitsEXT flags) {
+		if (flags & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+			return SEVERITY_ERROR;
+		}
+		if (flags & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+			return SEVERITY_WARNING;
+		}
+		if (flags & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+			return SEVERITY_INFO;
+		}
+		return SEVERITY_VERBOSE;
+	}
+
+	// The severities the messenger subscribes to. Anything below is never produced by the layers, which is where
+	// most of their cost goes, so the runtime filter can only move between this and SEVERITY_ERROR.
+	VkDebugUtilsMessageSeverityFlagsEXT subscribedFlags() const {
+		VkDebugUtilsMessageSeverityFlagsEXT flags = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		if (subscribedSeverity <= SEVERITY_WARNING) {
+			flags |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+		}
+		if (subscribedSeverity <= SEVERITY_INFO) {
+			flags |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+		}
+		if (subscribedSeverity <= SEVERITY_VERBOSE) {
+			flags |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+		}
+		return flags;
+	}
+
+	void start(Severity severity) {
+		subscribedSeverity = severity;
+		minimumSeverity = severity;
+		slots.reset(new Slot[RING_SIZE]);
+		for (uint32_t i = 0; i < RING_SIZE; i++) {
+			slots[i].sequence = i;
+		}
+		lastRepeatFlush = std::chrono::steady_clock::now();
+		stopping = false;
+		drainThread = std::thread(&ValidationLog::drainLoop, this);
+	}
+
+	// Prints whatever is still queued along with the totals.
+	void stop() {
+		if (!drainThread.joinable()) {
+			return;
+		}
+		stopping = true;
+		wakeCondition.notify_one();
+		drainThread.join();
+		if (received > 0) {
+			std::cerr << "Validation: " << received << " messages, " << duplicates << " repeats folded, " << rateLimited
+				<< " rate-limited, " << dropped << " dropped" << std::endl;
+		}
+	}
+
+	// Cycles the runtime filter through the subscribed severities.
+	void cycleMinimumSeverity() {
+		int next = minimumSeverity + 1;
+		minimumSeverity = next > SEVERITY_ERROR ? static_cast<int>(subscribedSeverity) : next;
+		std::cerr << "Validation messages below " << severityName(static_cast<Severity>(minimumSeverity.load())) << " are now hidden" << std::endl;
+	}
+
+	// Called on whichever thread the layer reports from; never blocks and never allocates.
+	void push(Severity severity, int32_t messageId, const char* text) {
+		if (severity < minimumSeverity.load(std::memory_order_relaxed)) {
+			return;
+		}
+		received++;
+		uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;) {
+			slot = &slots[position % RING_SIZE];
+			int64_t difference = static_cast<int64_t>(slot->sequence.load(std::memory_order_acquire)) - static_cast<int64_t>(position);
+			if (difference == 0) {
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (difference < 0) {
+				dropped++;
+				return;
+			}
+			else {
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+		slot->severity = severity;
+		slot->messageId = messageId;
+		size_t length = std::min(strlen(text), MAX_MESSAGE_LENGTH - 1);
+		memcpy(slot->text, text, length);
+		slot->text[length] = '\0';
+		slot->sequence.store(position + 1, std::memory_order_release);
+		if (severity == SEVERITY_ERROR) {
+			wakeCondition.notify_one();
+		}
+	}
+
+	void drainLoop() {
+		for (;;) {
+			bool finishing = stopping;
+			while (drainOne()) {
+			}
+			flushRepeats(finishing);
+			if (finishing) {
+				return;
+			}
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wakeCondition.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+
+	bool drainOne() {
+		Slot& slot = slots[dequeuePosition % RING_SIZE];
+		if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+			return false;
+		}
+		Severity severity = slot.severity;
+		int32_t messageId = slot.messageId;
+		std::string text = slot.text;
+		slot.sequence.store(dequeuePosition + RING_SIZE, std::memory_order_release);
+		dequeuePosition++;
+
+		auto repeat = repeats.find(text);
+		if (repeat != repeats.end()) {
+			repeat->second++;
+			duplicates++;
+			return true;
+		}
+		if (repeats.size() >= MAX_DISTINCT_MESSAGES) {
+			flushRepeats(true);
+			repeats.clear();
+		}
+		repeats[text] = 0;
+
+		auto now = std::chrono::steady_clock::now();
+		IdWindow& window = idWindows[messageId];
+		if (window.printed == 0 || now - window.start >= std::chrono::seconds(1)) {
+			if (window.suppressed > 0) {
+				std::cerr << "validation layer: " << window.suppressed << " more messages with ID " << messageId << " were rate-limited" << std::endl;
+			}
+			window.start = now;
+			window.printed = 0;
+			window.suppressed = 0;
+		}
+		if (window.printed >= MESSAGES_PER_ID_PER_SECOND) {
+			window.suppressed++;
+			rateLimited++;
+			return true;
+		}
+		window.printed++;
+		std::cerr << "validation layer [" << severityName(severity) << "]: " << text << "\n";
+		return true;
+	}
+
+	// Reports how often each message recurred since the last report, at most once a second unless forced.
+	void flushRepeats(bool force) {
+		auto now = std::chrono::steady_clock::now();
+		if (!force && now - lastRepeatFlush < std::chrono::seconds(1)) {
+			return;
+		}
+		lastRepeatFlush = now;
+		for (auto& repeat : repeats) {
+			if (repeat.second > 0) {
+				std::cerr << "validation layer: previous message repeated " << repeat.second << " times: " << repeat.first.substr(0, 120)
+					<< (repeat.first.size() > 120 ? "..." : "") << "\n";
+				repeat.second = 0;
+			}
+		}
+		std::cerr.flush();
+	}
+
+	void loadDeviceFunctions(VkInstance instance) {
+		setObjectName = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT");
+	}
+
+	// Names show up in validation messages instead of raw handles. A no-op without validation.
+	template <typename Handle>
+	void nameObject(VkDevice device, VkObjectType type, Handle handle, const std::string& name) const {
+		if (setObjectName == nullptr || handle == VK_NULL_HANDLE) {
+			return;
+		}
+		VkDebugUtilsObjectNameInfoEXT nameInfo = {};
+		nameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+		nameInfo.objectType = type;
+		nameInfo.objectHandle = reinterpret_cast<uint64_t>(handle);
+		nameInfo.pObjectName = name.c_str();
+		setObjectName(device, &nameInfo);
+	}
+};
+
+struct ApplicationOptions {
+	uint32_t framesInFlight = 2;
+	uint32_t width = WIDTH;
+	uint32_t height = HEIGHT;
+	// Windows (or offscreen targets when headless) drawn every frame with one submit and one present.
+	uint32_t windowCount = 1;
+	bool headless = false;
+	uint32_t frameLimit = 0;
+	// Frames rendered before any timing is kept; they count towards frameLimit.
+	uint32_t warmupFrames = 0;
+	bool pipelineStatistics = false;
+	std::string gpuStatsJson;
+	std::string gpuStatsCsv;
+	std::string pipelineCachePath = "pipeline_cache.bin";
+	VkDeviceSize stagingRingSize = 16 * 1024 * 1024;
+	uint32_t recordThreads = 0;
+	uint32_t drawCount = 1;
+	// 0 picks the default: a single instance, or 2^20 when sweeping.
+	uint32_t instanceCount = 0;
+	bool instanceSweep = false;
+	// Particles simulated on the async compute queue and drawn as points; 0 disables the simulation.
+	uint32_t particleCount = 0;
+	// Values above 1 zoom into the instance grid so the culling pass rejects everything outside the view.
+	float zoom = 1.0f;
+	// Physical device index or name substring; overrides VK_PHYSICAL_DEVICE and the device score.
+	std::string device;
+	PresentPolicy presentPolicy = PresentPolicy::fromName("balanced");
+	// Lists the available instance extensions and layers during startup.
+	bool verbose = false;
+	bool pipelineDerivatives = false;
+	// Routes the driver's host allocations through HostAllocator; turning it off leaves them to the driver's default.
+	bool hostAllocator = true;
+	// Validation messages below this severity are never requested from the layers.
+	ValidationLog::Severity validationSeverity = ValidationLog::SEVERITY_WARNING;
+	// Streams every presented frame to this file: .y4m for video, .png for one image per frame, anything else for raw RGBA.
+	std::string capturePath;
+	uint32_t captureBuffers = 4;
+	// A GPU frame rate to hold by drawing the scene below the output resolution and upscaling it; 0 turns the
+	// controller off. The scene is drawn at maxRenderScale whenever the controller is off.
+	float targetFps = 0.0f;
+	float minRenderScale = 0.5f;
+	float maxRenderScale = 1.0f;
+	// Loads SPIR-V from this directory instead of the shaders embedded in the binary. Builds without embedded shaders
+	// always load from files.
+#ifdef EMBEDDED_SHADERS
+	std::string shaderDirectory;
+#else
+	std::string shaderDirectory = "shaders";
+#endif
+
+	static uint32_t parseUnsigned(const std::string& name, const char* value) {
+		char* end = nullptr;
+		unsigned long result = strtoul(value, &end, 10);
+		if (end == value || *end != '\0') {
+			throw std::runtime_error("invalid value for " + name + ": " + value);
+		}
+		return static_cast<uint32_t>(result);
+	}
+
+	static float parseFloat(const std::string& name, const char* value) {
+		char* end = nullptr;
+		float result = strtof(value, &end);
+		if (end == value || *end != '\0') {
+			throw std::runtime_error("invalid value for " + name + ": " + value);
+		}
+		return result;
+	}
+
+	static ApplicationOptions parse(int argc, char* argv[]) {
+		ApplicationOptions options;
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--frames-in-flight" && i + 1 < argc) {
+				options.framesInFlight = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--width" && i + 1 < argc) {
+				options.width = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--height" && i + 1 < argc) {
+				options.height = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--windows" && i + 1 < argc) {
+				options.windowCount = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--headless") {
+				options.headless = true;
+			}
+			else if (arg == "--frames" && i + 1 < argc) {
+				options.frameLimit = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--warmup-frames" && i + 1 < argc) {
+				options.warmupFrames = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--pipeline-statistics") {
+				options.pipelineStatistics = true;
+			}
+			else if (arg == "--gpu-stats-json" && i + 1 < argc) {
+				options.gpuStatsJson = argv[++i];
+			}
+			else if (arg == "--gpu-stats-csv" && i + 1 < argc) {
+				options.gpuStatsCsv = argv[++i];
+			}
+			else if (arg == "--pipeline-cache" && i + 1 < argc) {
+				options.pipelineCachePath = argv[++i];
+			}
+			else if (arg == "--no-pipeline-cache") {
+				options.pipelineCachePath.clear();
+			}
+			else if (arg == "--record-threads" && i + 1 < argc) {
+				options.recordThreads = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--draw-count" && i + 1 < argc) {
+				options.drawCount = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--instances" && i + 1 < argc) {
+				options.instanceCount = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--instance-sweep") {
+				options.instanceSweep = true;
+			}
+			else if (arg == "--particles" && i + 1 < argc) {
+				options.particleCount = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--present-policy" && i + 1 < argc) {
+				uint32_t imageCount = options.presentPolicy.imageCount;
+				bool justInTimeInput = options.presentPolicy.justInTimeInput;
+				options.presentPolicy = PresentPolicy::fromName(argv[++i]);
+				options.presentPolicy.imageCount = imageCount;
+				options.presentPolicy.justInTimeInput |= justInTimeInput;
+			}
+			else if (arg == "--swapchain-images" && i + 1 < argc) {
+				options.presentPolicy.imageCount = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--jit-input") {
+				options.presentPolicy.justInTimeInput = true;
+			}
+			else if (arg == "--device" && i + 1 < argc) {
+				options.device = argv[++i];
+			}
+			else if (arg == "--zoom" && i + 1 < argc) {
+				options.zoom = parseFloat(arg, argv[++i]);
+			}
+			else if (arg == "--pipeline-derivatives") {
+				options.pipelineDerivatives = true;
+			}
+			else if (arg == "--capture" && i + 1 < argc) {
+				options.capturePath = argv[++i];
+			}
+			else if (arg == "--capture-buffers" && i + 1 < argc) {
+				options.captureBuffers = parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--target-fps" && i + 1 < argc) {
+				options.targetFps = parseFloat(arg, argv[++i]);
+			}
+			else if (arg == "--min-render-scale" && i + 1 < argc) {
+				options.minRenderScale = parseFloat(arg, argv[++i]);
+			}
+			else if (arg == "--max-render-scale" && i + 1 < argc) {
+				options.maxRenderScale = parseFloat(arg, argv[++i]);
+			}
+			else if (arg == "--no-host-allocator") {
+				options.hostAllocator = false;
+			}
+			else if (arg == "--shader-dir" && i + 1 < argc) {
+				options.shaderDirectory = argv[++i];
+			}
+			else if (arg == "--validation-severity" && i + 1 < argc) {
+				options.validationSeverity = ValidationLog::severityFromName(argv[++i]);
+			}
+			else if (arg == "--verbose") {
+				options.verbose = true;
+			}
+			else if (arg == "--staging-ring-mib" && i + 1 < argc) {
+				options.stagingRingSize = VkDeviceSize(parseUnsigned(arg, argv[++i])) * 1024 * 1024;
+			}
+			else {
+				throw std::runtime_error("unknown argument: " + arg);
+			}
+		}
+		if (options.framesInFlight == 0) {
+			throw std::runtime_error("--frames-in-flight must be at least 1!");
+		}
+		if (options.width == 0 || options.height == 0) {
+			throw std::runtime_error("--width and --height must be at least 1!");
+		}
+		if (options.windowCount == 0 || options.windowCount > MAX_WINDOWS) {
+			throw std::runtime_error("--windows must be between 1 and " + std::to_string(MAX_WINDOWS) + "!");
+		}
+		if (options.recordThreads == 0) {
+			options.recordThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		if (options.drawCount == 0) {
+			throw std::runtime_error("--draw-count must be at least 1!");
+		}
+		if (options.instanceCount == 0) {
+			options.instanceCount = options.instanceSweep ? 1u << 20 : 1;
+		}
+		if (!(options.zoom > 0.0f)) {
+			throw std::runtime_error("--zoom must be positive!");
+		}
+		if (options.captureBuffers == 0) {
+			throw std::runtime_error("--capture-buffers must be at least 1!");
+		}
+		if (options.stagingRingSize == 0) {
+			throw std::runtime_error("--staging-ring-mib must be at least 1!");
+		}
+		if (!(options.targetFps >= 0.0f)) {
+			throw std::runtime_error("--target-fps must not be negative!");
+		}
+		if (!(options.minRenderScale > 0.0f && options.minRenderScale <= options.maxRenderScale && options.maxRenderScale <= 1.0f)) {
+			throw std::runtime_error("render scales must satisfy 0 < --min-render-scale <= --max-render-scale <= 1!");
+		}
+		if (options.headless && options.frameLimit == 0) {
+			options.frameLimit = 1000;
+		}
+		return options;
+	}
+
+	bool scaledRendering() const {
+		return targetFps > 0.0f || maxRenderScale < 1.0f;
+	}
+};
+
+// What a run measured after its warm-up, for the benchmark to report.
+struct RunStats {
+	std::string deviceName;
+	uint64_t frames;
+	double seconds;
+	uint64_t trianglesPerFrame;
+	VkPresentModeKHR presentMode;
+	RollingHistogram::Summary cpuFrameMilliseconds;
+	RollingHistogram::Summary recordMilliseconds;
+	RollingHistogram::Summary gpuFrameMilliseconds;
+};
+
+class HelloTriangleApplication {
+public:
+	explicit HelloTriangleApplication(ApplicationOptions options) : options(options) {}
+
+	const RunStats& stats() const {
+		return runStats;
+	}
+
+	// A failed run still joins its threads and releases what it created before the error propagates, so the
+	// benchmark can report the failure and move on to its next scenario.
+	void run() {
+		launchTime = std::chrono::high_resolution_clock::now();
+		outputs.resize(options.windowCount);
+		hostAllocator.start();
+		try {
+			if (!options.headless) {
+				glfwInit();
+				for (auto& output : outputs) {
+					output.window = initWindow(options.width, options.height);
+				}
+			}
+			initVulkan();
+			mainLoop();
+		}
+		catch (...) {
+			cleanup();
+			throw;
+		}
+		cleanup();
+	}
+
+private:
+	ApplicationOptions options;
+	HostAllocator hostAllocator;
+	// Passed to every create and destroy call; null when the driver's own allocator is used.
+	VkAllocationCallbacks* allocator = nullptr;
+	VkInstance instance = VK_NULL_HANDLE;
+	VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
+	ValidationLog validationLog;
+	PhysicalDeviceContext physicalDeviceCtx;
+	LogicalDeviceContext logicalDeviceCtx = {};
+	SubmissionScheduler scheduler;
+	RenderGraph renderGraph;
+	uint32_t swapChainResource;
+	uint32_t sceneColorResource;
+	uint32_t scenePass;
+	uint32_t compositePass;
+	FrameCapture frameCapture;
+	PipelineCacheContext pipelineCacheCtx = {};
+	GraphicsPipelineCache pipelines;
+	// Modules stay alive for as long as the pipeline cache may compile descriptions that reference them.
+	std::unordered_map<std::string, VkShaderModule> shaderModules;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	GraphicsPipelineCache::Handle scenePipeline;
+	VkDescriptorSetLayout compositeSetLayout;
+	VkPipelineLayout compositePipelineLayout = VK_NULL_HANDLE;
+	GraphicsPipelineCache::Handle compositePipeline;
+	// With scaled rendering the composite pass samples the scene target through this instead of reading it as an
+	// input attachment.
+	VkSampler sceneSampler = VK_NULL_HANDLE;
+	ResolutionController resolution;
+
+	// A replaced swapchain and the graph targets built on it stay alive until every frame that could still reference
+	// them has retired.
+	struct RetiredSwapChain {
+		SwapChainContext swapChainCtx;
+		RenderGraph::Targets targets;
+		uint64_t retiredAtFrame;
+	};
+	// One window with its own surface, swapchain and graph targets. All outputs share the device, the compiled graph,
+	// the pipelines and the frame's command buffer; each is acquired, recreated and presented to independently.
+	struct Output {
+		GLFWwindow* window = nullptr;
+		VkSurfaceKHR surface = VK_NULL_HANDLE;
+		SwapChainContext swapChainCtx;
+		RenderGraph::Targets targets;
+		std::vector<RetiredSwapChain> retiredSwapChains;
+		// Indexed by frame in flight.
+		std::vector<VkSemaphore> imageAvailableSemaphores;
+		std::vector<VkSemaphore> renderFinishedSemaphores;
+		// The graphics submission that last rendered to each swapchain image.
+		std::vector<SubmissionScheduler::SyncPoint> imagesInFlight;
+		bool framebufferResized = false;
+		// Set while the swapchain could not be recreated, e.g. because the window is minimized.
+		bool outOfDate = false;
+		bool acquired = false;
+		uint32_t imageIndex = 0;
+	};
+	std::vector<Output> outputs;
+	// The output whose targets the graph is executing into.
+	uint32_t currentOutput = 0;
+	// The culling pass writes buffers shared by every output, so it only runs for the first one each frame.
+	bool cullRecorded = false;
+	uint32_t swapChainRecreations = 0;
+	std::vector<VkCommandBuffer> commandBuffers;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	static const uint32_t RECORD_JOBS_PER_WORKER = 4;
+	JobSystem jobSystem;
+	// Indexed by frame * jobSystem.workerCount() + worker.
+	std::vector<ThreadCommandPool> threadCommandPools;
+	RollingHistogram recordMilliseconds;
+	static const uint32_t SWEEP_WARMUP_FRAMES = 16;
+	static const uint32_t SWEEP_MEASURED_FRAMES = 128;
+	FrameRingBuffer instanceRing = {};
+	uint32_t activeInstanceCount;
+	GpuCullingContext cullingCtx = {};
+	ViewConstants viewConstants;
+	ParticleSimulation particleSim = {};
+	uint32_t particlePass;
+	GraphicsPipelineCache::Handle particlePipeline;
+	std::chrono::high_resolution_clock::time_point lastSimulationTime;
+	DescriptorSetLayoutCache layoutCache;
+	// SPIR-V found while the device is being created; released once startup has built every module. Embedded shaders
+	// point into the executable image and are never copied.
+	struct ShaderCode {
+		const uint32_t* code;
+		size_t size;
+		std::vector<uint32_t> words;
+	};
+	std::unordered_map<std::string, ShaderCode> shaderCode;
+	std::chrono::high_resolution_clock::time_point launchTime;
+	bool firstFrameReported = false;
+	RunStats runStats = {};
+	FrameDescriptorAllocator frameDescriptors;
+	VkDescriptorSetLayout objectSetLayout;
+	FrameRingBuffer uniformRing = {};
+	VkDeviceSize objectUniformStride;
+	// Set and ring offset of the current frame's per-draw uniforms, written before the draws are recorded.
+	VkDescriptorSet objectSet;
+	VkDeviceSize objectUniformBase;
+	std::chrono::high_resolution_clock::time_point animationStart;
+	DeviceMemoryAllocator memoryAllocator = {};
+	StagingRing stagingRing = {};
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	DeviceAllocation vertexBufferAllocation = {};
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	DeviceAllocation indexBufferAllocation = {};
+	GpuProfiler gpuProfiler;
+	// The graphics submission of each frame in flight; waiting on it replaces a per-frame fence.
+	std::vector<SubmissionScheduler::SyncPoint> frameSubmissions;
+	size_t currentFrame = 0;
+	uint64_t frameCount = 0;
+	uint64_t stallCount = 0;
+	double stallMilliseconds = 0.0;
+	FramePacer framePacer;
+
+	// Formats on the reporting thread into a bounded buffer, then hands off to the log's drain thread.
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageTypes,
+		const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
+		void* userData) {
+		ValidationLog* log = static_cast<ValidationLog*>(userData);
+		char text[ValidationLog::MAX_MESSAGE_LENGTH];
+		size_t length = 0;
+		auto append = [&](const char* part) {
+			size_t count = std::min(strlen(part), sizeof(text) - 1 - length);
+			memcpy(text + length, part, count);
+			length += count;
+			text[length] = '\0';
+		};
+		text[0] = '\0';
+		if (callbackData->pMessageIdName != nullptr) {
+			append(callbackData->pMessageIdName);
+			append(": ");
+		}
+		append(callbackData->pMessage);
+		bool namedObjects = false;
+		for (uint32_t i = 0; i < callbackData->objectCount; i++) {
+			if (callbackData->pObjects[i].pObjectName != nullptr) {
+				append(namedObjects ? ", " : " (objects: ");
+				append(callbackData->pObjects[i].pObjectName);
+				namedObjects = true;
+			}
+		}
+		if (namedObjects) {
+			append(")");
+		}
+		log->push(ValidationLog::severityFromFlags(messageSeverity), callbackData->messageIdNumber, text);
+		return VK_FALSE;
+	}
+
+	static VkDebugUtilsMessengerEXT createDebugMessenger(VkInstance instance, VkAllocationCallbacks* allocator, ValidationLog& log) {
+		if (!enableValidationLayers) return VK_NULL_HANDLE;
+		auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+		VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+		createInfo.messageSeverity = log.subscribedFlags();
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+			VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		createInfo.pfnUserCallback = debugCallback;
+		createInfo.pUserData = &log;
+		VkDebugUtilsMessengerEXT messenger;
+		if (func == nullptr || func(instance, &createInfo, allocator, &messenger) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to set up debug messenger!");
+		}
+		log.loadDeviceFunctions(instance);
+		return messenger;
+	}
+
+	static void destroyDebugMessenger(VkInstance instance, VkAllocationCallbacks* allocator, VkDebugUtilsMessengerEXT messenger) {
+		auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+		if (func != nullptr && messenger != VK_NULL_HANDLE) {
+			func(instance, messenger, allocator);
+		}
+	}
+
+	static std::vector<const char*> getRequiredExtensions(bool headless) {
+		std::vector<const char*> extensions;
+		if (!headless) {
+			unsigned int glfwExtensionCount = 0;
+			const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
+		if (enableValidationLayers) {
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
+		return extensions;
+	}
+
+	static void checkValidationLayerSupport(bool verbose) {
+		uint32_t layerCount;
+		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+		std::vector<VkLayerProperties> availableLayers(layerCount);
+		vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+		if (verbose) {
+			std::cout << "Available validation layers:" << std::endl;
+			for (const auto& layer : availableLayers) {
+				std::cout << "\t" << layer.layerName << std::endl;
+			}
+		}
+
+		std::vector<const char*> requestedLayers(validationLayers);
+		auto presentLayers = std::remove_if(requestedLayers.begin(), requestedLayers.end(), [&](const char* layer) {
+			auto result = std::find_if(availableLayers.begin(), availableLayers.end(), [&](VkLayerProperties props) {
+				return strcmp(layer, props.layerName) == 0;
+			});
+			return result != availableLayers.end();
+		});
+		requestedLayers.erase(presentLayers, requestedLayers.end());
+		
+		if (!requestedLayers.empty()) {
+			throw std::runtime_error("validation layers requested, but not available!");
+		}
+	}
+
+	static VkSurfaceKHR createSurface(VkInstance instance, VkAllocationCallbacks* allocator, GLFWwindow* window) {
+		VkSurfaceKHR surface;
+		if (glfwCreateWindowSurface(instance, window, allocator, &surface) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create window surface!");
+		}
+		return surface;
+	}
+
+	static VkInstance createInstance(VkAllocationCallbacks* allocator, bool headless, bool verbose) {
+		if (enableValidationLayers) {
+			checkValidationLayerSupport(verbose);
+		}
+
+		VkApplicationInfo appInfo = {};
+		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		appInfo.pApplicationName = "Hello Triangle";
+		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+		appInfo.pEngineName = "No Engine";
+		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+		// Vulkan 1.1 is the minimum; 1.1 devices get timeline semaphores from VK_KHR_timeline_semaphore.
+		appInfo.apiVersion = VK_API_VERSION_1_2;
+
+		uint32_t extensionCount = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+		if (verbose) {
+			std::cout << "Available extensions:" << std::endl;
+			for (const auto& extension : extensions) {
+				std::cout << "\t" << extension.extensionName << std::endl;
+			}
+		}
+
+		auto requiredExtensions = getRequiredExtensions(headless);
+		std::vector<const char*> requestedExtensions(requiredExtensions);
+		auto presentExtensions = std::remove_if(requestedExtensions.begin(), requestedExtensions.end(), [&](const char* ext) {
+			auto result = std::find_if(extensions.begin(), extensions.end(), [&](VkExtensionProperties props) {
+				return strcmp(ext, props.extensionName) == 0;
+			});
+			return result != extensions.end();
+		});
+		requestedExtensions.erase(presentExtensions, requestedExtensions.end());
+
+		if (!requestedExtensions.empty()) {
+			std::cout << "Some required extensions were missing: " << std::endl;
+			for (const auto& extension : requestedExtensions) {
+				std::cout << "\t" << extension << std::endl;
+			}
+		}
+
+		VkInstanceCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		createInfo.pApplicationInfo = &appInfo;
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
+		createInfo.ppEnabledExtensionNames = requiredExtensions.data();
+		createInfo.enabledLayerCount = 0;
+		if (enableValidationLayers) {
+			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+		}
+		else {
+			createInfo.enabledLayerCount = 0;
+		}
+
+		VkInstance instance;
+		if (vkCreateInstance(&createInfo, allocator, &instance) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create instance!");
+		}
+		return instance;
+	}
+
+	static VkShaderModule createShaderModule(VkDevice device, VkAllocationCallbacks* allocator, const uint32_t* code, size_t size) {
+		VkShaderModuleCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = size;
+		createInfo.pCode = code;
+		VkShaderModule shaderModule;
+		if (vkCreateShaderModule(device, &createInfo, allocator, &shaderModule) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create shader module!");
+		}
+		return shaderModule;
+	}
+
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		for (auto& output : app->outputs) {
+			if (output.window == window) {
+				output.framebufferResized = true;
+			}
+		}
+	}
+
+	// V cycles which validation messages are shown.
+	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		if (key == GLFW_KEY_V && action == GLFW_PRESS && enableValidationLayers) {
+			app->validationLog.cycleMinimumSeverity();
+		}
+	}
+
+	GLFWwindow* initWindow(uint32_t width, uint32_t height) {
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+		GLFWwindow* window = glfwCreateWindow(width, height, "Vulkan", nullptr, nullptr);
+		glfwSetWindowUserPointer(window, this);
+		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+		glfwSetKeyCallback(window, keyCallback);
+		return window;
+	}
+
+	static VkExtent2D getFramebufferExtent(GLFWwindow* window) {
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(window, &width, &height);
+		return { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+	}
+
+	// Startup runs as a task graph on the job system. Shader bytecode is read while the instance and device come up, and
+	// the render graph and pipelines only need the swapchain format, so pipeline compilation overlaps swapchain and
+	// render target creation. The swapchain waits for the compiled graph, which decides its image usage. Tasks sharing
+	// the memory allocator or the layout cache are chained by their dependencies.
+	void initVulkan() {
+		if (options.hostAllocator) {
+			allocator = &hostAllocator.callbacks;
+		}
+		jobSystem.start(options.recordThreads);
+		// GLFW only answers window queries on the main thread.
+		std::vector<VkExtent2D> windowExtents;
+		for (const auto& output : outputs) {
+			windowExtents.push_back(options.headless ? VkExtent2D{ options.width, options.height } : getFramebufferExtent(output.window));
+		}
+		StartupTaskGraph startup;
+
+		uint32_t loadShaders = startup.add("load_shaders", {}, [this] {
+			std::vector<std::string> names = { "vert", "frag", "fullscreen", options.scaledRendering() ? "upscale" : "composite", "cull" };
+			if (options.particleCount > 0) {
+				names.push_back("particle");
+				names.push_back("particles");
+			}
+			for (const auto& name : names) {
+				ShaderCode& shader = shaderCode[name];
+				shader.code = nullptr;
+#ifdef EMBEDDED_SHADERS
+				if (options.shaderDirectory.empty()) {
+					for (const auto& embedded : embeddedShaders) {
+						if (name == embedded.name) {
+							shader.code = embedded.code;
+							shader.size = embedded.size;
+						}
+					}
+					if (shader.code == nullptr) {
+						throw std::runtime_error("shader " + name + " was not embedded in the binary!");
+					}
+					continue;
+				}
+#endif
+				shader.words = readSpirvFile(options.shaderDirectory + "/" + name + ".spv");
+				shader.code = shader.words.data();
+				shader.size = shader.words.size() * sizeof(uint32_t);
+			}
+		});
+		uint32_t createInstanceTask = startup.add("instance", {}, [this] {
+			instance = createInstance(allocator, options.headless, options.verbose);
+			if (enableValidationLayers) {
+				validationLog.start(options.validationSeverity);
+			}
+			debugMessenger = createDebugMessenger(instance, allocator, validationLog);
+		});
+		uint32_t createSurfaceTask = startup.add("surface", { createInstanceTask }, [this] {
+			if (!options.headless) {
+				for (auto& output : outputs) {
+					output.surface = createSurface(instance, allocator, output.window);
+				}
+			}
+		});
+		uint32_t createDevice = startup.add("device", { createSurfaceTask }, [this] {
+			physicalDeviceCtx = PhysicalDeviceContext::findBest(instance, outputs[0].surface, options.device);
+			// The device is picked for the first window; the others have to be presentable from the same queue and offer
+			// the format the render graph is compiled for.
+			VkSurfaceFormatKHR graphFormat = SwapChainContext::surfaceFormatFor(physicalDeviceCtx, options.headless);
+			for (size_t i = 1; i < outputs.size() && !options.headless; i++) {
+				VkBool32 presentSupport = VK_FALSE;
+				vkGetPhysicalDeviceSurfaceSupportKHR(physicalDeviceCtx.physicalDevice, physicalDeviceCtx.queueFamilyIndices.present,
+					outputs[i].surface, &presentSupport);
+				if (!presentSupport) {
+					throw std::runtime_error("present queue cannot present to every window!");
+				}
+				SwapChainSupportDetails support = SwapChainSupportDetails::querySwapChainSupport(outputs[i].surface, physicalDeviceCtx.physicalDevice);
+				if (!SwapChainContext::supportsFormat(support.formats, graphFormat)) {
+					throw std::runtime_error("every window has to support the first window's swapchain format!");
+				}
+			}
+			logicalDeviceCtx = LogicalDeviceContext::create(physicalDeviceCtx, allocator);
+			memoryAllocator = DeviceMemoryAllocator::create(logicalDeviceCtx.device, allocator, physicalDeviceCtx);
+			scheduler = SubmissionScheduler::create(logicalDeviceCtx, physicalDeviceCtx, allocator);
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_SEMAPHORE, scheduler.semaphore(SubmissionScheduler::QUEUE_GRAPHICS), "graphics_timeline");
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_QUEUE, logicalDeviceCtx.graphicsQueue, "graphics_queue");
+			if (logicalDeviceCtx.transferQueue != logicalDeviceCtx.graphicsQueue) {
+				validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_QUEUE, logicalDeviceCtx.transferQueue, "transfer_queue");
+			}
+			if (logicalDeviceCtx.computeQueue != logicalDeviceCtx.graphicsQueue) {
+				validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_QUEUE, logicalDeviceCtx.computeQueue, "compute_queue");
+			}
+		});
+		uint32_t loadPipelineCache = startup.add("pipeline_cache", { createDevice }, [this] {
+			pipelineCacheCtx = PipelineCacheContext::create(logicalDeviceCtx.device, allocator, physicalDeviceCtx, options.pipelineCachePath);
+			pipelines.start(logicalDeviceCtx.device, allocator, pipelineCacheCtx.cache, std::max(std::thread::hardware_concurrency() / 4, 1u),
+				options.pipelineDerivatives);
+		});
+		uint32_t createShaderModules = startup.add("shader_modules", { loadShaders, createDevice }, [this] {
+			for (const auto& code : shaderCode) {
+				shaderModules[code.first] = createShaderModule(logicalDeviceCtx.device, allocator, code.second.code, code.second.size);
+			}
+		});
+		uint32_t createLayouts = startup.add("layouts", { createDevice }, [this] {
+			VkDescriptorSetLayoutBinding objectBinding = {};
+			objectBinding.binding = 0;
+			objectBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			objectBinding.descriptorCount = 1;
+			objectBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+			objectSetLayout = layoutCache.get(logicalDeviceCtx.device, allocator, { objectBinding });
+			pipelineLayout = createPipelineLayout(logicalDeviceCtx.device, allocator, objectSetLayout,
+				{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ViewConstants) });
+
+			VkDescriptorSetLayoutBinding sceneColorBinding = {};
+			sceneColorBinding.binding = 0;
+			sceneColorBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			sceneColorBinding.descriptorCount = 1;
+			sceneColorBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+			VkPushConstantRange compositeConstants = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ViewConstants) };
+			if (options.scaledRendering()) {
+				sceneSampler = createLinearSampler(logicalDeviceCtx.device, allocator);
+				sceneColorBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				compositeConstants = { VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscaleConstants) };
+			}
+			compositeSetLayout = layoutCache.get(logicalDeviceCtx.device, allocator, { sceneColorBinding });
+			compositePipelineLayout = createPipelineLayout(logicalDeviceCtx.device, allocator, compositeSetLayout, compositeConstants);
+			frameDescriptors = FrameDescriptorAllocator::create(logicalDeviceCtx.device, allocator, options.framesInFlight);
+		});
+		uint32_t compileRenderGraph = startup.add("render_graph", { createDevice }, [this] {
+			buildRenderGraph(SwapChainContext::surfaceFormatFor(physicalDeviceCtx, options.headless).format,
+				SwapChainContext::presentLayoutFor(options.headless));
+		});
+		uint32_t createSwapChain = startup.add("swapchain", { compileRenderGraph }, [this, windowExtents] {
+			for (size_t i = 0; i < outputs.size(); i++) {
+				if (options.headless) {
+					outputs[i].swapChainCtx = SwapChainContext::createOffscreen(logicalDeviceCtx.device, allocator, physicalDeviceCtx, memoryAllocator, windowExtents[i],
+						options.framesInFlight);
+				}
+				else {
+					outputs[i].swapChainCtx = SwapChainContext::create(outputs[i].surface, logicalDeviceCtx.device, allocator, physicalDeviceCtx,
+						windowExtents[i], renderGraph.resources[swapChainResource].usage, options.presentPolicy);
+				}
+			}
+		});
+		uint32_t createStagingRing = startup.add("staging_ring", { createSwapChain }, [this] {
+			stagingRing = StagingRing::create(logicalDeviceCtx, physicalDeviceCtx.queueFamilyIndices, memoryAllocator, scheduler, allocator,
+				options.stagingRingSize);
+		});
+		uint32_t realizeRenderGraph = startup.add("render_targets", { compileRenderGraph, createSwapChain, createStagingRing }, [this] {
+			for (uint32_t i = 0; i < outputs.size(); i++) {
+				Output& output = outputs[i];
+				if (renderGraph.resources[swapChainResource].format != output.swapChainCtx.surfaceFormat.format) {
+					throw std::runtime_error("swapchain format does not match the compiled render graph!");
+				}
+				renderGraph.bindImported(output.targets, swapChainResource, output.swapChainCtx.images, output.swapChainCtx.imageViews);
+				renderGraph.realize(memoryAllocator, output.targets, output.swapChainCtx.extent);
+				nameRenderTargets(i);
+			}
+			if (!options.capturePath.empty()) {
+				frameCapture.start(logicalDeviceCtx.device, options.capturePath, outputs[0].swapChainCtx.surfaceFormat.format, options.captureBuffers);
+			}
+		});
+
+		std::vector<uint32_t> pipelineDependencies = { createShaderModules, createLayouts, compileRenderGraph, loadPipelineCache };
+		startup.add("scene_pipeline", pipelineDependencies, [this] {
+			GraphicsPipelineDesc desc = pipelineDesc(scenePass, pipelineLayout, "vert", "frag");
+			desc.bindings = { Vertex::getBindingDescription(), InstanceData::getBindingDescription() };
+			for (const auto& attribute : Vertex::getAttributeDescriptions()) {
+				desc.attributes.push_back(attribute);
+			}
+			for (const auto& attribute : InstanceData::getAttributeDescriptions()) {
+				desc.attributes.push_back(attribute);
+			}
+			scenePipeline = pipelines.get(desc);
+		});
+		if (options.particleCount > 0) {
+			// Overlapping particles add up. The blended variant compiles in the background while the first frames draw
+			// the particles opaque.
+			startup.add("particle_pipeline", pipelineDependencies, [this] {
+				GraphicsPipelineDesc desc = pipelineDesc(particlePass, pipelineLayout, "particle", "frag");
+				auto particleAttributes = ParticleVertex::getAttributeDescriptions();
+				desc.bindings = { ParticleVertex::getBindingDescription() };
+				desc.attributes.assign(particleAttributes.begin(), particleAttributes.end());
+				desc.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+				GraphicsPipelineCache::Handle opaque = pipelines.get(desc);
+				desc.blendMode = GraphicsPipelineDesc::BLEND_ADDITIVE;
+				particlePipeline = pipelines.request(desc, opaque);
+			});
+		}
+		startup.add("composite_pipeline", pipelineDependencies, [this] {
+			compositePipeline = pipelines.get(pipelineDesc(compositePass, compositePipelineLayout, "fullscreen",
+				options.scaledRendering() ? "upscale" : "composite"));
+		});
+
+		startup.add("command_buffers", { createSwapChain }, [this] {
+			commandPool = createCommandPool(logicalDeviceCtx.device, allocator, physicalDeviceCtx.queueFamilyIndices);
+			createCommandBuffers();
+			createThreadCommandPools();
+			createSyncObjects();
+			for (size_t i = 0; i < commandBuffers.size(); i++) {
+				validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_COMMAND_BUFFER, commandBuffers[i], "frame_commands[" + std::to_string(i) + "]");
+			}
+		});
+		uint32_t createBuffers = startup.add("buffers", { realizeRenderGraph }, [this] {
+			createGeometryBuffers();
+			// The culling pass binds each frame's region as a storage buffer, so regions start at a storage-aligned offset.
+			VkDeviceSize storageAlignment = physicalDeviceCtx.properties.limits.minStorageBufferOffsetAlignment;
+			VkDeviceSize instanceFrameSize = VkDeviceSize(options.instanceCount) * sizeof(InstanceData);
+			instanceFrameSize = (instanceFrameSize + storageAlignment - 1) / storageAlignment * storageAlignment;
+			instanceRing = FrameRingBuffer::create(memoryAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, instanceFrameSize, options.framesInFlight);
+			VkDeviceSize uniformAlignment = physicalDeviceCtx.properties.limits.minUniformBufferOffsetAlignment;
+			objectUniformStride = (sizeof(ObjectUniforms) + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+			uniformRing = FrameRingBuffer::create(memoryAllocator, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, options.drawCount * objectUniformStride, options.framesInFlight);
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_BUFFER, vertexBuffer, "vertex_buffer");
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_BUFFER, indexBuffer, "index_buffer");
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_BUFFER, instanceRing.buffer, "instance_ring");
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_BUFFER, uniformRing.buffer, "object_uniform_ring");
+		});
+		uint32_t createCulling = startup.add("culling", { createBuffers, createLayouts, loadPipelineCache, createShaderModules }, [this] {
+			cullingCtx = GpuCullingContext::create(logicalDeviceCtx.device, allocator, physicalDeviceCtx, memoryAllocator, layoutCache, pipelineCacheCtx.cache,
+				shaderModules.at("cull"), instanceRing, options.framesInFlight);
+		});
+		if (options.particleCount > 0) {
+			startup.add("particles", { createCulling }, [this] {
+				particleSim = ParticleSimulation::create(logicalDeviceCtx, physicalDeviceCtx.queueFamilyIndices, memoryAllocator, allocator, layoutCache,
+					pipelineCacheCtx.cache, shaderModules.at("particles"), options.particleCount, options.framesInFlight);
+			});
+		}
+		startup.add("gpu_profiler", { createDevice }, [this] {
+			gpuProfiler = GpuProfiler::create(logicalDeviceCtx.device, allocator, physicalDeviceCtx, options.framesInFlight, options.pipelineStatistics);
+			double budget = options.targetFps > 0.0f ? 1000.0 / options.targetFps : 0.0;
+			if (budget > 0.0 && !gpuProfiler.timestampsEnabled) {
+				std::cout << "Dynamic resolution needs GPU timestamps; the scene stays at --max-render-scale" << std::endl;
+				budget = 0.0;
+			}
+			resolution = ResolutionController::create(budget, options.minRenderScale, options.maxRenderScale, options.framesInFlight);
+		});
+
+		startup.run(jobSystem);
+		shaderCode.clear();
+		framePacer.justInTime = options.presentPolicy.justInTimeInput && !options.headless;
+		activeInstanceCount = options.instanceCount;
+		animationStart = std::chrono::high_resolution_clock::now();
+
+		renderGraph.printSummary(outputs[0].targets);
+		if (outputs.size() > 1) {
+			std::cout << "Drawing " << outputs.size() << (options.headless ? " offscreen targets" : " windows")
+				<< " with one submit and one present per frame" << std::endl;
+		}
+		std::cout << "Pipelines built against a " << (pipelineCacheCtx.warm ? "warm" : "cold") << " pipeline cache" << std::endl;
+		std::cout << "GPU culling draws through " << (physicalDeviceCtx.drawIndirectCountExtension != nullptr
+			? physicalDeviceCtx.drawIndirectCountExtension : "vkCmdDrawIndexedIndirect") << std::endl;
+		if (options.particleCount > 0) {
+			std::cout << "Simulating " << options.particleCount << " particles on "
+				<< (particleSim.ownershipTransferRequired() ? "a dedicated compute queue" : "the graphics queue family") << std::endl;
+		}
+		startup.printSummary();
+	}
+
+	void nameRenderTargets(uint32_t outputIndex) {
+		const Output& output = outputs[outputIndex];
+		std::string prefix = outputs.size() > 1 ? "window" + std::to_string(outputIndex) + "." : "";
+		for (size_t i = 0; i < output.swapChainCtx.images.size(); i++) {
+			validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_IMAGE, output.swapChainCtx.images[i], prefix + "swapchain[" + std::to_string(i) + "]");
+		}
+		for (size_t i = 0; i < renderGraph.resources.size(); i++) {
+			if (renderGraph.resources[i].image && i < output.targets.images.size()) {
+				validationLog.nameObject(logicalDeviceCtx.device, VK_OBJECT_TYPE_IMAGE, output.targets.images[i], prefix + renderGraph.resources[i].name);
+			}
+		}
+	}
+
+	// The description every pipeline of a graph pass starts from: the subpass the pass was merged into and two of the
+	// shader modules created during startup.
+	GraphicsPipelineDesc pipelineDesc(uint32_t pass, VkPipelineLayout layout, const std::string& vertName, const std::string& fragName) {
+		GraphicsPipelineDesc desc;
+		desc.renderPass = renderGraph.renderPassFor(pass, desc.subpass);
+		desc.layout = layout;
+		desc.vertShader = shaderModules.at(vertName);
+		desc.fragShader = shaderModules.at(fragName);
+		return desc;
+	}
+
+	// The frame is culled on the GPU, drawn into an intermediate color target and composited onto the swapchain image.
+	// The scene and composite passes end up as two subpasses of one render pass, which lets the intermediate target
+	// stay in tile memory on GPUs that support it. With scaled rendering the scene only covers part of the target and
+	// the composite pass upscales it with a filtered read, which a subpass input cannot do, so the two passes split.
+	// Only the swapchain format is needed here; the targets are realized once the swapchain exists.
+	void buildRenderGraph(VkFormat swapChainFormat, VkImageLayout presentLayout) {
+		renderGraph = RenderGraph::create(logicalDeviceCtx.device, allocator);
+		swapChainResource = renderGraph.importImage("swapchain", swapChainFormat, presentLayout);
+		VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+		sceneColorResource = renderGraph.createImage("scene_color", swapChainFormat, VK_IMAGE_ASPECT_COLOR_BIT, clearColor);
+		renderGraph.resources[sceneColorResource].dynamicExtent = options.scaledRendering();
+		uint32_t instances = renderGraph.importBuffer("instances");
+		uint32_t visibleInstances = renderGraph.importBuffer("visible_instances");
+		uint32_t indirectDraws = renderGraph.importBuffer("indirect_draws");
+
+		renderGraph.addPass("cull", false, {
+			{ instances, RenderGraph::ACCESS_STORAGE_READ },
+			{ visibleInstances, RenderGraph::ACCESS_STORAGE_WRITE },
+			{ indirectDraws, RenderGraph::ACCESS_STORAGE_WRITE }
+		}, [this](const RenderGraph::PassContext& ctx) {
+			if (!cullRecorded) {
+				cullingCtx.record(ctx.commandBuffer, static_cast<uint32_t>(currentFrame), viewConstants, static_cast<uint32_t>(indices.size()));
+				cullRecorded = true;
+			}
+		});
+		scenePass = renderGraph.addPass("scene", true, {
+			{ visibleInstances, RenderGraph::ACCESS_VERTEX_READ },
+			{ indirectDraws, RenderGraph::ACCESS_INDIRECT_READ },
+			{ sceneColorResource, RenderGraph::ACCESS_COLOR_ATTACHMENT }
+		}, [this](const RenderGraph::PassContext& ctx) {
+			recordScene(ctx);
+		});
+		renderGraph.passes[scenePass].secondaryContents = true;
+		if (options.particleCount > 0) {
+			uint32_t particleVertices = renderGraph.importBuffer("particle_vertices");
+			particlePass = renderGraph.addPass("particles", true, {
+				{ particleVertices, RenderGraph::ACCESS_VERTEX_READ },
+				{ sceneColorResource, RenderGraph::ACCESS_COLOR_ATTACHMENT }
+			}, [this](const RenderGraph::PassContext& ctx) {
+				recordParticles(ctx);
+			});
+		}
+		compositePass = renderGraph.addPass("composite", true, {
+			{ sceneColorResource, options.scaledRendering() ? RenderGraph::ACCESS_SAMPLED : RenderGraph::ACCESS_INPUT_ATTACHMENT },
+			{ swapChainResource, RenderGraph::ACCESS_COLOR_ATTACHMENT }
+		}, [this](const RenderGraph::PassContext& ctx) {
+			recordComposite(ctx);
+		});
+		// Reading the swapchain image back adds transfer usage to the swapchain and a copy after the composite. Only the
+		// first window is captured.
+		if (!options.capturePath.empty()) {
+			uint32_t capturePass = renderGraph.addPass("capture", false, {
+				{ swapChainResource, RenderGraph::ACCESS_TRANSFER_READ }
+			}, [this](const RenderGraph::PassContext& ctx) {
+				if (currentOutput == 0) {
+					frameCapture.record(ctx.commandBuffer, memoryAllocator, outputs[0].swapChainCtx.images[ctx.imageIndex], ctx.extent,
+						scheduler.nextPoint(SubmissionScheduler::QUEUE_GRAPHICS));
+				}
+			});
+			renderGraph.passes[capturePass].sideEffects = true;
+		}
+
+		renderGraph.compile();
+	}
+
+	static VkPipelineLayout createPipelineLayout(VkDevice device, VkAllocationCallbacks* allocator, VkDescriptorSetLayout setLayout,
+		const VkPushConstantRange& pushConstantRange) {
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &setLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		VkPipelineLayout layout;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &layout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+		return layout;
+	}
+
+	static VkSampler createLinearSampler(VkDevice device, VkAllocationCallbacks* allocator) {
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.maxLod = 0.0f;
+
+		VkSampler sampler;
+		if (vkCreateSampler(device, &samplerInfo, allocator, &sampler) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create sampler!");
+		}
+		return sampler;
+	}
+
+	static VkCommandPool createCommandPool(VkDevice device, VkAllocationCallbacks* allocator, QueueFamilyIndices queueFamilyIndices) {
+		VkCommandPoolCreateInfo poolInfo = {};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphics;
-		poolInfo.flags = 0; // Optional
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+		VkCommandPool pool;
+		if (vkCreateCommandPool(device, &poolInfo, allocator, &pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create command pool!");
+		}
+		return pool;
+	}
+
+	void createCommandBuffers() {
+		commandBuffers.resize(options.framesInFlight);
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+
+		if (vkAllocateCommandBuffers(logicalDeviceCtx.device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
+	}
+
+	void createThreadCommandPools() {
+		for (uint32_t i = 0; i < options.framesInFlight * jobSystem.workerCount(); i++) {
+			threadCommandPools.push_back(ThreadCommandPool::create(logicalDeviceCtx.device, allocator, physicalDeviceCtx.queueFamilyIndices.graphics));
+		}
+	}
+
+	// Geometry lives in device-local memory and is filled through the staging ring; the graphics queue never
+	// records the copies itself.
+	void createGeometryBuffers() {
+		VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
+		vertexBufferAllocation = memoryAllocator.createBuffer(vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, vertexBuffer);
+		stagingRing.upload(vertexBuffer, 0, vertices.data(), vertexBufferSize, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+		VkDeviceSize indexBufferSize = sizeof(indices[0]) * indices.size();
+		indexBufferAllocation = memoryAllocator.createBuffer(indexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, indexBuffer);
+		stagingRing.upload(indexBuffer, 0, indices.data(), indexBufferSize, VK_ACCESS_INDEX_READ_BIT);
+	}
+
+	// Lays the instances out on a square grid covering the viewport and spins them at index-dependent speeds. The
+	// frame's ring region is free once its previous submission has completed; the fill is split across the job system.
+	void updateInstanceData() {
+		instanceRing.beginFrame(static_cast<uint32_t>(currentFrame));
+		void* data = nullptr;
+		if (instanceRing.allocate(VkDeviceSize(activeInstanceCount) * sizeof(InstanceData), sizeof(float), &data) == VK_WHOLE_SIZE) {
+			throw std::runtime_error("instance ring buffer is too small!");
+		}
+		InstanceData* instances = static_cast<InstanceData*>(data);
+
+		uint32_t count = activeInstanceCount;
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+		float cell = 2.0f / side;
+		float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - animationStart).count();
+
+		viewConstants.center[0] = 0.0f;
+		viewConstants.center[1] = 0.0f;
+		viewConstants.zoom = options.zoom;
+		viewConstants.instanceCount = count;
+
+		uint32_t jobCount = std::min(count, jobSystem.workerCount() * RECORD_JOBS_PER_WORKER);
+		std::vector<JobSystem::Job> jobs;
+		for (uint32_t job = 0; job < jobCount; job++) {
+			uint32_t first = static_cast<uint32_t>(uint64_t(count) * job / jobCount);
+			uint32_t end = static_cast<uint32_t>(uint64_t(count) * (job + 1) / jobCount);
+			jobs.push_back([=](uint32_t) {
+				for (uint32_t i = first; i < end; i++) {
+					uint32_t x = i % side;
+					uint32_t y = i / side;
+					InstanceData& instance = instances[i];
+					instance.offset[0] = -1.0f + cell * (x + 0.5f);
+					instance.offset[1] = -1.0f + cell * (y + 0.5f);
+					instance.scale = cell * 0.5f;
+					instance.rotation = time * 0.25f * (i % 8);
+					uint32_t red = 255 - x * 128 / side;
+					uint32_t green = 255 - y * 128 / side;
+					instance.color = red | (green << 8) | (255u << 16) | (255u << 24);
+				}
+			});
+		}
+		jobSystem.dispatch(jobs);
+	}
+
+	// Writes one ObjectUniforms per draw into this frame's uniform ring region and allocates the frame's descriptor set
+	// from the pools that were reset for it. Every draw then binds the same set with its own dynamic offset. The draws
+	// are fanned out in a ring around the grid, except the first, which stays centered.
+	void updateObjectUniforms() {
+		frameDescriptors.beginFrame(static_cast<uint32_t>(currentFrame));
+		uniformRing.beginFrame(static_cast<uint32_t>(currentFrame));
+		void* data = nullptr;
+		objectUniformBase = uniformRing.allocate(options.drawCount * objectUniformStride, objectUniformStride, &data);
+		if (objectUniformBase == VK_WHOLE_SIZE) {
+			throw std::runtime_error("uniform ring buffer is too small!");
+		}
+		for (uint32_t draw = 0; draw < options.drawCount; draw++) {
+			ObjectUniforms* object = reinterpret_cast<ObjectUniforms*>(static_cast<char*>(data) + draw * objectUniformStride);
+			float angle = 6.2831853f * draw / options.drawCount;
+			float radius = draw == 0 ? 0.0f : 0.05f;
+			object->offset[0] = radius * std::cos(angle);
+			object->offset[1] = radius * std::sin(angle);
+			object->brightness = 1.0f / (1.0f + 0.1f * draw);
+			object->padding = 0.0f;
+		}
+
+		objectSet = frameDescriptors.allocate(objectSetLayout);
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = uniformRing.buffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = sizeof(ObjectUniforms);
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = objectSet;
+		write.dstBinding = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		write.pBufferInfo = &bufferInfo;
+		vkUpdateDescriptorSets(logicalDeviceCtx.device, 1, &write, 0, nullptr);
+	}
+
+	// The graph is executed once per acquired output into that output's targets.
+	void recordCommandBuffer(VkCommandBuffer commandBuffer) {
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		gpuProfiler.beginFrame(commandBuffer, static_cast<uint32_t>(currentFrame));
+		stagingRing.recordAcquireBarriers(commandBuffer);
+		if (options.particleCount > 0) {
+			particleSim.recordAcquireBarrier(commandBuffer, static_cast<uint32_t>(currentFrame));
+		}
+		updateObjectUniforms();
+		uint32_t workerCount = jobSystem.workerCount();
+		for (uint32_t worker = 0; worker < workerCount; worker++) {
+			threadCommandPools[currentFrame * workerCount + worker].reset(logicalDeviceCtx.device);
+		}
+		cullRecorded = false;
+		for (uint32_t i = 0; i < outputs.size(); i++) {
+			if (outputs[i].acquired) {
+				currentOutput = i;
+				renderGraph.execute(commandBuffer, outputs[i].targets, outputs[i].imageIndex, resolution.apply(outputs[i].targets.extent), gpuProfiler);
+			}
+		}
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
 
-		VkCommandPool pool;
-		if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create command pool!");
+	// The draws are split into contiguous ranges, each recorded into its own secondary buffer by whichever worker
+	// picks the job up; executing the secondaries in range order keeps the draw order stable.
+	void recordScene(const RenderGraph::PassContext& ctx) {
+		uint32_t workerCount = jobSystem.workerCount();
+		uint32_t jobCount = std::min(options.drawCount, workerCount * RECORD_JOBS_PER_WORKER);
+		std::vector<VkCommandBuffer> secondaryBuffers(jobCount);
+		std::vector<JobSystem::Job> jobs;
+		for (uint32_t job = 0; job < jobCount; job++) {
+			uint32_t firstDraw = static_cast<uint32_t>(uint64_t(options.drawCount) * job / jobCount);
+			uint32_t endDraw = static_cast<uint32_t>(uint64_t(options.drawCount) * (job + 1) / jobCount);
+			jobs.push_back([this, job, firstDraw, endDraw, &ctx, &secondaryBuffers](uint32_t worker) {
+				secondaryBuffers[job] = recordDrawRange(worker, ctx, firstDraw, endDraw);
+			});
 		}
-		return pool;
+		jobSystem.dispatch(jobs);
+		vkCmdExecuteCommands(ctx.commandBuffer, jobCount, secondaryBuffers.data());
 	}
 
-	void createCommandBuffers() {
-		commandBuffers.resize(swapChainFramebuffers.size());
+	void recordParticles(const RenderGraph::PassContext& ctx) {
+		vkCmdBindPipeline(ctx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.resolve(particlePipeline));
+		setViewportAndScissor(ctx.commandBuffer, ctx.extent);
+		vkCmdPushConstants(ctx.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ViewConstants), &viewConstants);
+		particleSim.draw(ctx.commandBuffer, static_cast<uint32_t>(currentFrame));
+	}
 
-		VkCommandBufferAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = commandPool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+	void recordComposite(const RenderGraph::PassContext& ctx) {
+		VkDescriptorSet set = frameDescriptors.allocate(compositeSetLayout);
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.sampler = sceneSampler;
+		imageInfo.imageView = renderGraph.imageView(outputs[currentOutput].targets, sceneColorResource, ctx.imageIndex);
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = options.scaledRendering() ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		write.pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(logicalDeviceCtx.device, 1, &write, 0, nullptr);
 
-		if (vkAllocateCommandBuffers(logicalDeviceCtx.device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate command buffers!");
+		vkCmdBindPipeline(ctx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.resolve(compositePipeline));
+		setViewportAndScissor(ctx.commandBuffer, ctx.extent);
+		vkCmdBindDescriptorSets(ctx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, compositePipelineLayout, 0, 1, &set, 0, nullptr);
+		if (options.scaledRendering()) {
+			// The scene target has the output's extent; only the top-left renderExtent of it was drawn this frame.
+			VkExtent2D renderExtent = resolution.apply(ctx.extent);
+			UpscaleConstants upscale = {};
+			upscale.uvScale[0] = static_cast<float>(renderExtent.width) / (static_cast<float>(ctx.extent.width) * ctx.extent.width);
+			upscale.uvScale[1] = static_cast<float>(renderExtent.height) / (static_cast<float>(ctx.extent.height) * ctx.extent.height);
+			upscale.uvMax[0] = (renderExtent.width - 0.5f) / ctx.extent.width;
+			upscale.uvMax[1] = (renderExtent.height - 0.5f) / ctx.extent.height;
+			vkCmdPushConstants(ctx.commandBuffer, compositePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscaleConstants), &upscale);
 		}
+		vkCmdDraw(ctx.commandBuffer, 3, 1, 0, 0);
+	}
+
+	static void setViewportAndScissor(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float)extent.width;
+		viewport.height = (float)extent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo = {};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-			beginInfo.pInheritanceInfo = nullptr; // Optional
+		VkRect2D scissor = {};
+		scissor.offset = { 0, 0 };
+		scissor.extent = extent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
 
-			vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+	// Runs on a job system worker; only touches that worker's command pool for the current frame.
+	VkCommandBuffer recordDrawRange(uint32_t worker, const RenderGraph::PassContext& ctx, uint32_t firstDraw, uint32_t endDraw) {
+		ThreadCommandPool& pool = threadCommandPools[currentFrame * jobSystem.workerCount() + worker];
+		VkCommandBuffer commandBuffer = pool.acquireSecondary(logicalDeviceCtx.device);
 
-			VkRenderPassBeginInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass;
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent = swapChainCtx.extent;
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = ctx.renderPass;
+		inheritanceInfo.subpass = ctx.subpass;
+		inheritanceInfo.framebuffer = ctx.framebuffer;
 
-			VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-			renderPassInfo.clearValueCount = 1;
-			renderPassInfo.pClearValues = &clearColor;
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-			vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
-			vkCmdEndRenderPass(commandBuffers[i]);
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.resolve(scenePipeline));
+		setViewportAndScissor(commandBuffer, ctx.extent);
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
-			}
+		VkBuffer vertexBuffers[] = { vertexBuffer, cullingCtx.frames[currentFrame].visibleBuffer };
+		VkDeviceSize offsets[] = { 0, 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ViewConstants), &viewConstants);
+
+		for (uint32_t draw = firstDraw; draw < endDraw; draw++) {
+			uint32_t dynamicOffset = static_cast<uint32_t>(objectUniformBase + draw * objectUniformStride);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &objectSet, 1, &dynamicOffset);
+			cullingCtx.draw(commandBuffer, static_cast<uint32_t>(currentFrame));
 		}
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record secondary command buffer!");
+		}
+		return commandBuffer;
 	}
 	
-	static VkSemaphore createSemaphore(VkDevice device) {
+	static VkSemaphore createSemaphore(VkDevice device, VkAllocationCallbacks* allocator) {
 		VkSemaphoreCreateInfo semaphoreInfo = {};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
 		VkSemaphore semaphore;
-		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+		if (vkCreateSemaphore(device, &semaphoreInfo, allocator, &semaphore) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create semaphores!");
 		}
 		return semaphore;
 	}
 
+	void createSyncObjects() {
+		frameSubmissions.assign(options.framesInFlight, SubmissionScheduler::SyncPoint());
+		for (auto& output : outputs) {
+			output.imageAvailableSemaphores.resize(options.framesInFlight);
+			output.renderFinishedSemaphores.resize(options.framesInFlight);
+			output.imagesInFlight.assign(output.swapChainCtx.images.size(), SubmissionScheduler::SyncPoint());
+			for (size_t i = 0; i < options.framesInFlight; i++) {
+				output.imageAvailableSemaphores[i] = createSemaphore(logicalDeviceCtx.device, allocator);
+				output.renderFinishedSemaphores[i] = createSemaphore(logicalDeviceCtx.device, allocator);
+			}
+		}
+	}
+
+	// Returns the time spent blocked, in milliseconds.
+	double waitForSubmission(SubmissionScheduler::SyncPoint point) {
+		if (scheduler.isComplete(point)) {
+			return 0.0;
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		scheduler.wait(point);
+		auto end = std::chrono::high_resolution_clock::now();
+		double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+		stallCount++;
+		stallMilliseconds += milliseconds;
+		return milliseconds;
+	}
+
+	uint32_t countQueuedFrames() {
+		uint32_t queued = 0;
+		for (const auto& point : frameSubmissions) {
+			if (!scheduler.isComplete(point)) {
+				queued++;
+			}
+		}
+		return queued;
+	}
+
+	// The graph's render passes and the pipelines only depend on the surface format, so a resize rebuilds nothing but the
+	// output's swapchain, its image views and its graph targets. The old ones are retired rather than destroyed behind a
+	// device stall. A minimized window cannot have a swapchain; it is left out of date and skipped until it has an area
+	// again, without holding up the other windows.
+	void recreateSwapChain(uint32_t outputIndex) {
+		Output& output = outputs[outputIndex];
+		VkExtent2D extent = getFramebufferExtent(output.window);
+		if (extent.width == 0 || extent.height == 0) {
+			output.outOfDate = true;
+			return;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		RetiredSwapChain retired = {};
+		retired.swapChainCtx = output.swapChainCtx;
+		retired.targets = output.targets;
+		retired.retiredAtFrame = frameCount;
+		output.retiredSwapChains.push_back(retired);
+
+		output.swapChainCtx = SwapChainContext::create(output.surface, logicalDeviceCtx.device, allocator, physicalDeviceCtx, extent,
+			renderGraph.resources[swapChainResource].usage, options.presentPolicy, retired.swapChainCtx.chain);
+		if (output.swapChainCtx.surfaceFormat.format != retired.swapChainCtx.surfaceFormat.format) {
+			throw std::runtime_error("swapchain format changed during recreation!");
+		}
+		output.targets = {};
+		renderGraph.bindImported(output.targets, swapChainResource, output.swapChainCtx.images, output.swapChainCtx.imageViews);
+		renderGraph.realize(memoryAllocator, output.targets, output.swapChainCtx.extent);
+		nameRenderTargets(outputIndex);
+		output.imagesInFlight.assign(output.swapChainCtx.images.size(), SubmissionScheduler::SyncPoint());
+		output.framebufferResized = false;
+		output.outOfDate = false;
+		swapChainRecreations++;
+
+		std::cout << "Recreated swapchain" << (outputs.size() > 1 ? " of window " + std::to_string(outputIndex) : "") << " at "
+			<< output.swapChainCtx.extent.width << "x" << output.swapChainCtx.extent.height << " in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+	}
+
+	// Frames up to frameCount - framesInFlight are known to be complete once the current frame's submission has been waited on.
+	void destroyRetiredSwapChains(bool all) {
+		for (auto& output : outputs) {
+			auto it = output.retiredSwapChains.begin();
+			while (it != output.retiredSwapChains.end()) {
+				if (all || frameCount + 1 >= it->retiredAtFrame + options.framesInFlight) {
+					renderGraph.destroyTargets(memoryAllocator, it->targets);
+					it->swapChainCtx.destroy(logicalDeviceCtx.device, allocator, memoryAllocator);
+					it = output.retiredSwapChains.erase(it);
+				}
+				else {
+					++it;
+				}
+			}
+		}
+	}
+
+	// Steps are sized by wall-clock time, clamped so a stall does not launch the particles out of the view.
+	void simulateParticles() {
+		auto now = std::chrono::high_resolution_clock::now();
+		float deltaTime = particleSim.stepCount == 0 ? 0.0f : std::chrono::duration<float>(now - lastSimulationTime).count();
+		lastSimulationTime = now;
+		float time = std::chrono::duration<float>(now - animationStart).count();
+		particleSim.simulate(scheduler, static_cast<uint32_t>(currentFrame), std::min(deltaTime, 1.0f / 30.0f), time);
+	}
+
+	// Each output acquires its own image; one that is out of date is recreated and sits the frame out. The outputs that
+	// did acquire are drawn by one submission and handed to the presentation engine by one vkQueuePresentKHR, whose
+	// per-swapchain results are handled separately.
 	void drawFrame() {
-		uint32_t imageIndex;
-		vkAcquireNextImageKHR(logicalDeviceCtx.device, swapChainCtx.chain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+		double blockedMilliseconds = waitForSubmission(frameSubmissions[currentFrame]);
+		gpuProfiler.collect(logicalDeviceCtx.device, static_cast<uint32_t>(currentFrame));
+		resolution.update(static_cast<uint32_t>(currentFrame), gpuProfiler.lastFrameMilliseconds);
+		if (!options.capturePath.empty()) {
+			frameCapture.poll(scheduler);
+		}
+		destroyRetiredSwapChains(false);
+
+		bool anyAcquired = false;
+		for (uint32_t i = 0; i < outputs.size(); i++) {
+			Output& output = outputs[i];
+			output.acquired = false;
+			if (options.headless) {
+				output.imageIndex = static_cast<uint32_t>(frameCount % output.swapChainCtx.images.size());
+			}
+			else {
+				if (output.outOfDate) {
+					recreateSwapChain(i);
+					if (output.outOfDate) {
+						continue;
+					}
+				}
+				auto acquireStart = std::chrono::high_resolution_clock::now();
+				VkResult result = vkAcquireNextImageKHR(logicalDeviceCtx.device, output.swapChainCtx.chain, std::numeric_limits<uint64_t>::max(),
+					output.imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &output.imageIndex);
+				blockedMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - acquireStart).count();
+				if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+					recreateSwapChain(i);
+					continue;
+				}
+				else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+					throw std::runtime_error("failed to acquire swap chain image!");
+				}
+			}
 
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			blockedMilliseconds += waitForSubmission(output.imagesInFlight[output.imageIndex]);
+			output.acquired = true;
+			anyAcquired = true;
+		}
+		if (!anyAcquired) {
+			// Every window is minimized or was just recreated; nothing is submitted and the frame slot stays complete.
+			glfwWaitEventsTimeout(0.1);
+			return;
+		}
+		framePacer.frameBlocked(blockedMilliseconds);
 
-		VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
-		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = waitSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+		stagingRing.flush();
+		if (options.particleCount > 0) {
+			simulateParticles();
+		}
+		updateInstanceData();
+		auto recordStart = std::chrono::high_resolution_clock::now();
+		vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+		recordCommandBuffer(commandBuffers[currentFrame]);
+		recordMilliseconds.add(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count());
 
-		VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
+		std::vector<SubmissionScheduler::Dependency> waits;
+		std::vector<VkSemaphore> signalSemaphores;
+		std::vector<VkSwapchainKHR> swapChains;
+		std::vector<uint32_t> imageIndices;
+		std::vector<uint32_t> presentedOutputs;
+		for (uint32_t i = 0; i < outputs.size() && !options.headless; i++) {
+			if (outputs[i].acquired) {
+				waits.push_back(SubmissionScheduler::afterBinary(outputs[i].imageAvailableSemaphores[currentFrame],
+					VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT));
+				signalSemaphores.push_back(outputs[i].renderFinishedSemaphores[currentFrame]);
+				swapChains.push_back(outputs[i].swapChainCtx.chain);
+				imageIndices.push_back(outputs[i].imageIndex);
+				presentedOutputs.push_back(i);
+			}
+		}
+		stagingRing.takeWaits(waits);
+		if (options.particleCount > 0) {
+			waits.push_back(scheduler.after(particleSim.frames[currentFrame].finished, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT));
+		}
+		// The uploads, the particle step and the frame reach the driver together, one vkQueueSubmit per queue.
+		SubmissionScheduler::SyncPoint point = scheduler.submit(SubmissionScheduler::QUEUE_GRAPHICS, { commandBuffers[currentFrame] }, waits,
+			signalSemaphores);
+		scheduler.flush();
+		frameSubmissions[currentFrame] = point;
+		for (auto& output : outputs) {
+			if (output.acquired) {
+				output.imagesInFlight[output.imageIndex] = point;
+			}
+		}
+		framePacer.frameSubmitted(countQueuedFrames());
 
-		if (vkQueueSubmit(logicalDeviceCtx.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-			throw std::runtime_error("failed to submit draw command buffer!");
+		if (options.headless) {
+			currentFrame = (currentFrame + 1) % options.framesInFlight;
+			frameCount++;
+			return;
 		}
 
 		VkPresentInfoKHR presentInfo = {};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		presentInfo.waitSemaphoreCount = 1;
-		presentInfo.pWaitSemaphores = signalSemaphores;
+		presentInfo.waitSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		presentInfo.pWaitSemaphores = signalSemaphores.data();
+
+		std::vector<VkResult> results(swapChains.size(), VK_SUCCESS);
+		presentInfo.swapchainCount = static_cast<uint32_t>(swapChains.size());
+		presentInfo.pSwapchains = swapChains.data();
+		presentInfo.pImageIndices = imageIndices.data();
+		presentInfo.pResults = results.data();
+
+		VkResult result = vkQueuePresentKHR(logicalDeviceCtx.presentQueue, &presentInfo);
+
+		currentFrame = (currentFrame + 1) % options.framesInFlight;
+		frameCount++;
+
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
+			throw std::runtime_error("failed to present swap chain image!");
+		}
+		for (size_t i = 0; i < presentedOutputs.size(); i++) {
+			Output& output = outputs[presentedOutputs[i]];
+			if (results[i] == VK_ERROR_OUT_OF_DATE_KHR || results[i] == VK_SUBOPTIMAL_KHR || output.framebufferResized) {
+				recreateSwapChain(presentedOutputs[i]);
+			}
+			else if (results[i] != VK_SUCCESS) {
+				throw std::runtime_error("failed to present swap chain image!");
+			}
+		}
+	}
+
+	bool shouldExit() {
+		if (options.frameLimit > 0 && frameCount >= options.frameLimit) {
+			return true;
+		}
+		return anyWindowClosed();
+	}
+
+	// Closing any window ends the run.
+	bool anyWindowClosed() {
+		for (const auto& output : outputs) {
+			if (output.window != nullptr && glfwWindowShouldClose(output.window)) {
+				return true;
+			}
+		}
+		return false;
+	}
 
-		VkSwapchainKHR swapChains[] = { swapChainCtx.chain };
-		presentInfo.swapchainCount = 1;
-		presentInfo.pSwapchains = swapChains;
-		presentInfo.pImageIndices = &imageIndex;
-		presentInfo.pResults = nullptr; // Optional
+	// Renders a fixed number of frames at each instance count from 1 up to options.instanceCount in powers of ten and
+	// reports the average frame time once the frames-in-flight pipeline has filled.
+	void runInstanceSweep() {
+		std::vector<uint32_t> counts;
+		for (uint64_t count = 1; count < options.instanceCount; count *= 10) {
+			counts.push_back(static_cast<uint32_t>(count));
+		}
+		counts.push_back(options.instanceCount);
 
-		vkQueuePresentKHR(logicalDeviceCtx.presentQueue, &presentInfo);
+		std::cout << std::setw(12) << "instances" << std::setw(14) << "ms/frame" << std::setw(18) << "Minstances/s" << std::endl;
+		for (uint32_t count : counts) {
+			activeInstanceCount = count;
+			auto measureStart = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < SWEEP_WARMUP_FRAMES + SWEEP_MEASURED_FRAMES; i++) {
+				if (i == SWEEP_WARMUP_FRAMES) {
+					measureStart = std::chrono::high_resolution_clock::now();
+				}
+				if (!options.headless) {
+					glfwPollEvents();
+					if (anyWindowClosed()) {
+						return;
+					}
+				}
+				drawFrame();
+			}
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - measureStart).count() / SWEEP_MEASURED_FRAMES;
+			std::cout << std::setw(12) << count << std::setw(14) << std::fixed << std::setprecision(3) << milliseconds
+				<< std::setw(18) << count / milliseconds / 1000.0 << std::defaultfloat << std::endl;
+		}
+	}
 
-		vkQueueWaitIdle(logicalDeviceCtx.presentQueue);
+	// Starts the measured part of a run. With a frame limit the histograms keep every measured frame, so their summaries
+	// describe the same frames as the reported frame count.
+	void resetMeasurements() {
+		size_t capacity = RollingHistogram::WINDOW_SIZE;
+		if (options.frameLimit > options.warmupFrames) {
+			capacity = std::max(capacity, size_t(options.frameLimit - options.warmupFrames));
+		}
+		framePacer.resetMeasurements(capacity);
+		recordMilliseconds = RollingHistogram(capacity);
+		gpuProfiler.resetMeasurements(capacity);
+		hostAllocator.resetMeasurements();
+		resolution.scales = RollingHistogram(capacity);
 	}
 
 	void mainLoop() {
-		while (!glfwWindowShouldClose(window)) {
-			glfwPollEvents();
-			drawFrame();
+		auto start = std::chrono::high_resolution_clock::now();
+		resetMeasurements();
+		uint64_t measuredFrom = 0;
+		if (options.instanceSweep) {
+			runInstanceSweep();
+		}
+		else {
+			while (!shouldExit()) {
+				framePacer.throttle();
+				if (!options.headless) {
+					glfwPollEvents();
+				}
+				drawFrame();
+				if (frameCount == 1 && !firstFrameReported) {
+					firstFrameReported = true;
+					std::cout << "Time to first frame: " << std::chrono::duration<double, std::milli>(
+						std::chrono::high_resolution_clock::now() - launchTime).count() << " ms" << std::endl;
+				}
+				if (options.warmupFrames > 0 && measuredFrom == 0 && frameCount >= options.warmupFrames) {
+					measuredFrom = frameCount;
+					start = std::chrono::high_resolution_clock::now();
+					resetMeasurements();
+				}
+			}
 		}
 
 		vkDeviceWaitIdle(logicalDeviceCtx.device);
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		uint64_t measuredFrames = frameCount - measuredFrom;
+		const SwapChainContext& swapChainCtx = outputs[0].swapChainCtx;
+		std::cout << "Rendered " << measuredFrames << " frames at " << swapChainCtx.extent.width << "x" << swapChainCtx.extent.height
+			<< (outputs.size() > 1 ? " to " + std::to_string(outputs.size()) + " windows" : "")
+			<< " in " << seconds << " s (" << (seconds > 0.0 ? measuredFrames / seconds : 0.0) << " frames/s)";
+		if (measuredFrom > 0) {
+			std::cout << " after " << measuredFrom << " warm-up frames";
+		}
+		std::cout << std::endl;
+		std::cout << options.framesInFlight << " frames in flight; "
+			<< "CPU blocked on a queue timeline " << stallCount << " times (" << stallMilliseconds << " ms total)" << std::endl;
+		scheduler.printSummary();
+		RollingHistogram::Summary record = recordMilliseconds.summarize();
+		std::cout << "Recorded " << options.drawCount << " draws of " << activeInstanceCount << " instances per frame on " << jobSystem.workerCount() << " threads: avg "
+			<< record.avg << " ms, p99 " << record.p99 << " ms, max " << record.max << " ms" << std::endl;
+		if (!options.headless) {
+			std::cout << "Presented with " << PresentPolicy::presentModeName(swapChainCtx.presentMode) << " and "
+				<< swapChainCtx.images.size() << " swapchain images (" << options.presentPolicy.name << " policy)" << std::endl;
+		}
+		framePacer.printSummary();
+		if (options.scaledRendering()) {
+			resolution.printSummary();
+		}
+		pipelines.printSummary();
+		std::cout << "Allocated " << frameDescriptors.setsAllocated << " descriptor sets from " << frameDescriptors.poolsCreated
+			<< " pools; " << layoutCache.size() << " cached set layouts" << std::endl;
+		if (swapChainRecreations > 0) {
+			std::cout << "Swapchain was recreated " << swapChainRecreations << " times" << std::endl;
+		}
+
+		std::cout << "Uploaded " << stagingRing.bytesUploaded << " bytes in " << stagingRing.batchesSubmitted << " transfer batches ("
+			<< (stagingRing.ownershipTransferRequired() ? "dedicated transfer queue" : "graphics queue family") << ", "
+			<< stagingRing.ringStalls << " staging ring stalls)" << std::endl;
+		memoryAllocator.printStats();
+		if (allocator != nullptr) {
+			hostAllocator.printSummary(measuredFrames);
+		}
+		gpuProfiler.collectAll(logicalDeviceCtx.device);
+		gpuProfiler.printSummary();
+		if (!options.gpuStatsJson.empty()) {
+			gpuProfiler.writeJson(options.gpuStatsJson);
+		}
+		if (!options.gpuStatsCsv.empty()) {
+			gpuProfiler.writeCsv(options.gpuStatsCsv);
+		}
+
+		runStats.deviceName = physicalDeviceCtx.properties.deviceName;
+		runStats.frames = measuredFrames;
+		runStats.seconds = seconds;
+		runStats.trianglesPerFrame = uint64_t(options.drawCount) * activeInstanceCount * (indices.size() / 3);
+		runStats.presentMode = outputs[0].swapChainCtx.presentMode;
+		runStats.cpuFrameMilliseconds = framePacer.intervals.summarize();
+		runStats.recordMilliseconds = recordMilliseconds.summarize();
+		runStats.gpuFrameMilliseconds = gpuProfiler.frameTimings.summarize();
 	}
 
+	// Also runs when startup or a frame threw, so anything may be missing: handles that were never created are null
+	// and contexts that were never created are empty.
 	void cleanup() {
-		vkDestroySemaphore(logicalDeviceCtx.device, renderFinishedSemaphore, nullptr);
-		vkDestroySemaphore(logicalDeviceCtx.device, imageAvailableSemaphore, nullptr);
-		vkDestroyCommandPool(logicalDeviceCtx.device, commandPool, nullptr);
-		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-			vkDestroyFramebuffer(logicalDeviceCtx.device, swapChainFramebuffers[i], nullptr);
+		if (logicalDeviceCtx.device != VK_NULL_HANDLE) {
+			vkDeviceWaitIdle(logicalDeviceCtx.device);
+		}
+		frameCapture.stop(memoryAllocator, scheduler);
+		jobSystem.stop();
+		pipelines.destroy();
+		if (logicalDeviceCtx.device != VK_NULL_HANDLE) {
+			destroyDeviceObjects();
+		}
+		for (const auto& output : outputs) {
+			if (output.surface != VK_NULL_HANDLE) {
+				vkDestroySurfaceKHR(instance, output.surface, allocator);
+			}
+		}
+		if (instance != VK_NULL_HANDLE) {
+			destroyDebugMessenger(instance, allocator, debugMessenger);
+		}
+		validationLog.stop();
+		vkDestroyInstance(instance, allocator);
+		hostAllocator.destroy();
+		if (!options.headless) {
+			for (const auto& output : outputs) {
+				glfwDestroyWindow(output.window);
+			}
+			glfwTerminate();
+		}
+	}
+
+	void destroyDeviceObjects() {
+		gpuProfiler.destroy(logicalDeviceCtx.device, allocator);
+		for (auto& output : outputs) {
+			for (VkSemaphore semaphore : output.renderFinishedSemaphores) {
+				vkDestroySemaphore(logicalDeviceCtx.device, semaphore, allocator);
+			}
+			for (VkSemaphore semaphore : output.imageAvailableSemaphores) {
+				vkDestroySemaphore(logicalDeviceCtx.device, semaphore, allocator);
+			}
+		}
+		for (auto& pool : threadCommandPools) {
+			pool.destroy(logicalDeviceCtx.device, allocator);
+		}
+		vkDestroyCommandPool(logicalDeviceCtx.device, commandPool, allocator);
+		for (const auto& module : shaderModules) {
+			vkDestroyShaderModule(logicalDeviceCtx.device, module.second, allocator);
+		}
+		if (pipelineCacheCtx.cache != VK_NULL_HANDLE) {
+			pipelineCacheCtx.save(logicalDeviceCtx.device);
+			pipelineCacheCtx.destroy(logicalDeviceCtx.device, allocator);
+		}
+		vkDestroyPipelineLayout(logicalDeviceCtx.device, compositePipelineLayout, allocator);
+		vkDestroyPipelineLayout(logicalDeviceCtx.device, pipelineLayout, allocator);
+		vkDestroySampler(logicalDeviceCtx.device, sceneSampler, allocator);
+		frameDescriptors.destroy();
+		layoutCache.destroy(logicalDeviceCtx.device, allocator);
+		// Everything below holds device memory; the allocator is created right after the device.
+		if (memoryAllocator.device != VK_NULL_HANDLE) {
+			destroyRetiredSwapChains(true);
+			for (auto& output : outputs) {
+				renderGraph.destroyTargets(memoryAllocator, output.targets);
+				output.swapChainCtx.destroy(logicalDeviceCtx.device, allocator, memoryAllocator);
+			}
+			renderGraph.destroy();
+			cullingCtx.destroy(logicalDeviceCtx.device, allocator, memoryAllocator);
+			if (options.particleCount > 0) {
+				particleSim.destroy(logicalDeviceCtx.device, allocator, memoryAllocator);
+			}
+			uniformRing.destroy(memoryAllocator);
+			instanceRing.destroy(memoryAllocator);
+			memoryAllocator.destroyBuffer(indexBuffer, indexBufferAllocation);
+			memoryAllocator.destroyBuffer(vertexBuffer, vertexBufferAllocation);
+			if (stagingRing.buffer != VK_NULL_HANDLE) {
+				stagingRing.destroy(memoryAllocator);
+			}
+			memoryAllocator.destroy();
+		}
+		scheduler.destroy();
+		logicalDeviceCtx.destroy(allocator);
+	}
+};
+
+// Just enough JSON to read a benchmark report back: objects, arrays, strings, numbers, booleans and null.
+struct JsonValue {
+	enum Type {
+		JSON_NULL,
+		JSON_BOOL,
+		JSON_NUMBER,
+		JSON_STRING,
+		JSON_ARRAY,
+		JSON_OBJECT
+	};
+
+	Type type = JSON_NULL;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> elements;
+	std::vector<std::pair<std::string, JsonValue>> members;
+
+	const JsonValue* find(const std::string& key) const {
+		for (const auto& member : members) {
+			if (member.first == key) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+
+	// Follows a dotted path of object keys, e.g. "cpu_frame_ms.avg".
+	bool numberAt(const std::string& path, double& result) const {
+		const JsonValue* value = this;
+		size_t begin = 0;
+		while (value != nullptr && begin <= path.size()) {
+			size_t end = path.find('.', begin);
+			value = value->find(path.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+			if (end == std::string::npos) {
+				break;
+			}
+			begin = end + 1;
+		}
+		if (value == nullptr || value->type != JSON_NUMBER) {
+			return false;
+		}
+		result = value->number;
+		return true;
+	}
+
+	static JsonValue parse(const std::string& text) {
+		size_t pos = 0;
+		JsonValue value = parseValue(text, pos);
+		skipSpace(text, pos);
+		if (pos != text.size()) {
+			fail(pos);
+		}
+		return value;
+	}
+
+	static void fail(size_t pos) {
+		throw std::runtime_error("invalid JSON at offset " + std::to_string(pos) + "!");
+	}
+
+	static void skipSpace(const std::string& text, size_t& pos) {
+		while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) {
+			pos++;
+		}
+	}
+
+	static void expect(const std::string& text, size_t& pos, char c) {
+		skipSpace(text, pos);
+		if (pos >= text.size() || text[pos] != c) {
+			fail(pos);
+		}
+		pos++;
+	}
+
+	static std::string parseString(const std::string& text, size_t& pos) {
+		expect(text, pos, '"');
+		std::string result;
+		while (pos < text.size() && text[pos] != '"') {
+			if (text[pos] == '\\' && pos + 1 < text.size()) {
+				pos++;
+				switch (text[pos]) {
+				case 'n': result += '\n'; break;
+				case 't': result += '\t'; break;
+				case 'r': result += '\r'; break;
+				default: result += text[pos]; break;
+				}
+			}
+			else {
+				result += text[pos];
+			}
+			pos++;
+		}
+		expect(text, pos, '"');
+		return result;
+	}
+
+	static JsonValue parseValue(const std::string& text, size_t& pos) {
+		skipSpace(text, pos);
+		if (pos >= text.size()) {
+			fail(pos);
+		}
+		JsonValue value;
+		char c = text[pos];
+		if (c == '{') {
+			value.type = JSON_OBJECT;
+			pos++;
+			skipSpace(text, pos);
+			if (pos < text.size() && text[pos] == '}') {
+				pos++;
+				return value;
+			}
+			for (;;) {
+				std::string key = parseString(text, pos);
+				expect(text, pos, ':');
+				value.members.emplace_back(key, parseValue(text, pos));
+				skipSpace(text, pos);
+				if (pos < text.size() && text[pos] == ',') {
+					pos++;
+					continue;
+				}
+				expect(text, pos, '}');
+				return value;
+			}
+		}
+		if (c == '[') {
+			value.type = JSON_ARRAY;
+			pos++;
+			skipSpace(text, pos);
+			if (pos < text.size() && text[pos] == ']') {
+				pos++;
+				return value;
+			}
+			for (;;) {
+				value.elements.push_back(parseValue(text, pos));
+				skipSpace(text, pos);
+				if (pos < text.size() && text[pos] == ',') {
+					pos++;
+					continue;
+				}
+				expect(text, pos, ']');
+				return value;
+			}
+		}
+		if (c == '"') {
+			value.type = JSON_STRING;
+			value.string = parseString(text, pos);
+			return value;
+		}
+		if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+			value.type = JSON_BOOL;
+			value.boolean = c == 't';
+			pos += value.boolean ? 4 : 5;
+			return value;
+		}
+		if (text.compare(pos, 4, "null") == 0) {
+			pos += 4;
+			return value;
+		}
+		char* end = nullptr;
+		value.number = strtod(text.c_str() + pos, &end);
+		if (end == text.c_str() + pos) {
+			fail(pos);
+		}
+		value.type = JSON_NUMBER;
+		pos = end - text.c_str();
+		return value;
+	}
+
+	static JsonValue load(const std::string& filename) {
+		std::ifstream stream(filename, std::ios::in | std::ios::binary);
+		if (!stream.is_open()) {
+			throw std::runtime_error("failed to open " + filename + "!");
 		}
-		vkDestroyPipeline(logicalDeviceCtx.device, graphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(logicalDeviceCtx.device, pipelineLayout, nullptr);
-		vkDestroyRenderPass(logicalDeviceCtx.device, renderPass, nullptr);
-		swapChainCtx.destroy(logicalDeviceCtx.device, nullptr);
-		logicalDeviceCtx.destroy(nullptr);
-		vkDestroySurfaceKHR(instance, surface, nullptr);
-		DestroyDebugReportCallbackEXT(instance, callback, nullptr);
-		vkDestroyInstance(instance, nullptr);
-		glfwDestroyWindow(window);
-		glfwTerminate();
+		std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+		return parse(text);
 	}
 };
 
-int main() {
-	HelloTriangleApplication app;
+// Runs fixed-length scenarios, each in a fresh headless application, and writes what they measured as JSON. Given a
+// baseline report it compares every scenario metric against it and fails when one got slower than the threshold
+// allows, so it can gate changes to the render loop. Any Vulkan device works, including software rasterizers picked
+// with --device (e.g. "llvmpipe").
+struct Benchmark {
+	struct Options {
+		uint32_t frames = 300;
+		uint32_t warmupFrames = 60;
+		bool full = false;
+		// Windowed scenarios measure the present policies; they need a display.
+		bool windowed = false;
+		std::string filter;
+		std::string device;
+		std::string output = "benchmark.json";
+		std::string baseline;
+		// Compares this report against the baseline instead of running the scenarios.
+		std::string report;
+		double threshold = 0.05;
+	};
+
+	struct Scenario {
+		std::string name;
+		std::vector<std::string> args;
+	};
+
+	static Options parse(int argc, char* argv[]) {
+		Options options;
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--frames" && i + 1 < argc) {
+				options.frames = ApplicationOptions::parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--warmup-frames" && i + 1 < argc) {
+				options.warmupFrames = ApplicationOptions::parseUnsigned(arg, argv[++i]);
+			}
+			else if (arg == "--full") {
+				options.full = true;
+			}
+			else if (arg == "--windowed") {
+				options.windowed = true;
+			}
+			else if (arg == "--filter" && i + 1 < argc) {
+				options.filter = argv[++i];
+			}
+			else if (arg == "--device" && i + 1 < argc) {
+				options.device = argv[++i];
+			}
+			else if (arg == "--output" && i + 1 < argc) {
+				options.output = argv[++i];
+			}
+			else if (arg == "--compare" && i + 1 < argc) {
+				options.baseline = argv[++i];
+			}
+			else if (arg == "--report" && i + 1 < argc) {
+				options.report = argv[++i];
+			}
+			else if (arg == "--threshold" && i + 1 < argc) {
+				options.threshold = ApplicationOptions::parseFloat(arg, argv[++i]) / 100.0;
+			}
+			else {
+				throw std::runtime_error("unknown argument: " + arg);
+			}
+		}
+		if (options.frames == 0) {
+			throw std::runtime_error("--frames must be at least 1!");
+		}
+		if (!options.report.empty() && options.baseline.empty()) {
+			throw std::runtime_error("--report needs a baseline to --compare against!");
+		}
+		return options;
+	}
+
+	// Every scenario starts from 4096 instances at 1280x720 with two frames in flight and changes one thing.
+	static std::vector<Scenario> scenarios(const Options& options) {
+		std::vector<Scenario> all = {
+			{ "instances-1", { "--instances", "1" } },
+			{ "instances-4k", {} },
+			{ "instances-256k", { "--instances", "262144" } },
+			{ "frames-in-flight-1", { "--frames-in-flight", "1" } },
+			{ "frames-in-flight-3", { "--frames-in-flight", "3" } },
+			{ "resolution-640x360", { "--width", "640", "--height", "360" } },
+			{ "resolution-1920x1080", { "--width", "1920", "--height", "1080" } },
+			{ "render-scale-0.5", { "--max-render-scale", "0.5" } }
+		};
+		if (options.full) {
+			all.push_back({ "instances-1m", { "--instances", "1048576" } });
+			all.push_back({ "draws-64", { "--draw-count", "64" } });
+			all.push_back({ "resolution-3840x2160", { "--width", "3840", "--height", "2160" } });
+		}
+		if (options.windowed) {
+			for (const char* policy : { "low-latency", "balanced", "vsync" }) {
+				all.push_back({ std::string("present-") + policy, { "--present-policy", policy } });
+			}
+		}
+
+		std::vector<Scenario> selected;
+		for (auto& scenario : all) {
+			if (options.filter.empty() || scenario.name.find(options.filter) != std::string::npos) {
+				selected.push_back(scenario);
+			}
+		}
+		return selected;
+	}
+
+	// Scenario arguments come last so they override the common ones.
+	static ApplicationOptions applicationOptions(const Options& options, const Scenario& scenario) {
+		std::vector<std::string> args = { "--width", "1280", "--height", "720", "--instances", "4096",
+			"--frames", std::to_string(options.warmupFrames + options.frames), "--warmup-frames", std::to_string(options.warmupFrames) };
+		if (scenario.name.compare(0, 8, "present-") != 0) {
+			args.push_back("--headless");
+		}
+		if (!options.device.empty()) {
+			args.push_back("--device");
+			args.push_back(options.device);
+		}
+		args.insert(args.end(), scenario.args.begin(), scenario.args.end());
+
+		std::vector<char*> argv = { const_cast<char*>("HelloTriangle") };
+		for (const auto& arg : args) {
+			argv.push_back(const_cast<char*>(arg.c_str()));
+		}
+		return ApplicationOptions::parse(static_cast<int>(argv.size()), argv.data());
+	}
+
+	static std::string escape(const std::string& text) {
+		std::string result;
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				result += '\\';
+			}
+			result += c;
+		}
+		return result;
+	}
+
+	static std::string runScenarios(const Options& options) {
+		std::vector<Scenario> selected = scenarios(options);
+		if (selected.empty()) {
+			throw std::runtime_error("no benchmark scenario matches " + options.filter + "!");
+		}
+
+		std::ostringstream scenarioJson;
+		scenarioJson << std::setprecision(6) << std::fixed;
+		std::string deviceName;
+		for (size_t i = 0; i < selected.size(); i++) {
+			const Scenario& scenario = selected[i];
+			std::cout << "=== Scenario " << scenario.name << " (" << i + 1 << "/" << selected.size() << ")" << std::endl;
+			std::string args;
+			for (const auto& arg : scenario.args) {
+				args += (args.empty() ? "" : " ") + arg;
+			}
+			scenarioJson << (i == 0 ? "\n" : ",\n") << "    { \"name\": \"" << scenario.name << "\", \"args\": \"" << escape(args) << "\", ";
+			try {
+				ApplicationOptions appOptions = applicationOptions(options, scenario);
+				HelloTriangleApplication app(appOptions);
+				app.run();
+				const RunStats& stats = app.stats();
+				deviceName = stats.deviceName;
+				double fps = stats.seconds > 0.0 ? stats.frames / stats.seconds : 0.0;
+				scenarioJson << "\"present_mode\": \"" << (appOptions.headless ? "offscreen" : PresentPolicy::presentModeName(stats.presentMode))
+					<< "\", \"frames\": " << stats.frames << ", \"seconds\": " << stats.seconds << ", \"fps\": " << fps
+					<< ", \"triangles_per_second\": " << fps * stats.trianglesPerFrame << ",\n      \"cpu_frame_ms\": ";
+				GpuProfiler::writeJsonSummary(scenarioJson, stats.cpuFrameMilliseconds);
+				scenarioJson << ",\n      \"record_ms\": ";
+				GpuProfiler::writeJsonSummary(scenarioJson, stats.recordMilliseconds);
+				scenarioJson << ",\n      \"gpu_frame_ms\": ";
+				GpuProfiler::writeJsonSummary(scenarioJson, stats.gpuFrameMilliseconds);
+				scenarioJson << " }";
+			}
+			catch (const std::runtime_error& e) {
+				std::cerr << "Scenario " << scenario.name << " failed: " << e.what() << std::endl;
+				scenarioJson << "\"error\": \"" << escape(e.what()) << "\" }";
+			}
+		}
+
+		std::ostringstream report;
+		report << "{\n  \"device\": \"" << escape(deviceName) << "\",\n  \"frames\": " << options.frames << ",\n  \"warmup_frames\": "
+			<< options.warmupFrames << ",\n  \"scenarios\": [" << scenarioJson.str() << "\n  ]\n}\n";
+		return report.str();
+	}
+
+	static const JsonValue* findScenario(const JsonValue& report, const std::string& name) {
+		const JsonValue* scenarios = report.find("scenarios");
+		if (scenarios == nullptr) {
+			return nullptr;
+		}
+		for (const auto& scenario : scenarios->elements) {
+			const JsonValue* scenarioName = scenario.find("name");
+			if (scenarioName != nullptr && scenarioName->string == name) {
+				return &scenario;
+			}
+		}
+		return nullptr;
+	}
+
+	// Returns false if any metric regressed. Metrics a report could not measure (no GPU timestamps, failed scenarios)
+	// are skipped rather than treated as regressions.
+	static bool compare(const JsonValue& baseline, const JsonValue& current, double threshold) {
+		static const char* metrics[] = { "cpu_frame_ms.avg", "cpu_frame_ms.p99", "record_ms.avg", "gpu_frame_ms.avg", "gpu_frame_ms.p99" };
+		const JsonValue* baselineDevice = baseline.find("device");
+		const JsonValue* currentDevice = current.find("device");
+		if (baselineDevice != nullptr && currentDevice != nullptr && baselineDevice->string != currentDevice->string) {
+			std::cout << "Warning: baseline was measured on " << baselineDevice->string << ", this run on " << currentDevice->string << std::endl;
+		}
+
+		bool passed = true;
+		const JsonValue* scenarios = current.find("scenarios");
+		std::cout << std::left << std::setw(24) << "scenario" << std::setw(20) << "metric" << std::right << std::setw(12) << "baseline"
+			<< std::setw(12) << "current" << std::setw(10) << "change" << std::endl;
+		for (const auto& scenario : scenarios != nullptr ? scenarios->elements : std::vector<JsonValue>()) {
+			const JsonValue* name = scenario.find("name");
+			const JsonValue* reference = name != nullptr ? findScenario(baseline, name->string) : nullptr;
+			if (reference == nullptr) {
+				continue;
+			}
+			for (const char* metric : metrics) {
+				double before, after;
+				if (!reference->numberAt(metric, before) || !scenario.numberAt(metric, after) || before <= 0.0) {
+					continue;
+				}
+				double change = after / before - 1.0;
+				const char* verdict = "";
+				if (change > threshold) {
+					verdict = "  REGRESSION";
+					passed = false;
+				}
+				else if (change < -threshold) {
+					verdict = "  improved";
+				}
+				std::cout << std::left << std::setw(24) << name->string << std::setw(20) << metric << std::right << std::fixed << std::setprecision(3)
+					<< std::setw(12) << before << std::setw(12) << after << std::setw(9) << std::showpos << change * 100.0 << "%" << std::noshowpos
+					<< std::defaultfloat << verdict << std::endl;
+			}
+		}
+		std::cout << (passed ? "No regressions" : "Performance regressed") << " (threshold " << threshold * 100.0 << "%)" << std::endl;
+		return passed;
+	}
+
+	static int run(int argc, char* argv[]) {
+		Options options = parse(argc, argv);
+		JsonValue current;
+		if (!options.report.empty()) {
+			current = JsonValue::load(options.report);
+		}
+		else {
+			std::string report = runScenarios(options);
+			std::ofstream out(options.output, std::ios::out | std::ios::trunc);
+			if (!out.is_open()) {
+				throw std::runtime_error("failed to open " + options.output + " for writing!");
+			}
+			out << report;
+			std::cout << "Wrote " << options.output << std::endl;
+			current = JsonValue::parse(report);
+		}
+		if (!options.baseline.empty() && !compare(JsonValue::load(options.baseline), current, options.threshold)) {
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+};
 
+#ifdef BENCHMARK_MAIN
+int main(int argc, char* argv[]) {
+	try {
+		return Benchmark::run(argc, argv);
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
+#else
+int main(int argc, char* argv[]) {
+	ApplicationOptions options;
 	try {
+		options = ApplicationOptions::parse(argc, argv);
+		HelloTriangleApplication app(options);
 		app.run();
 	}
 	catch (const std::runtime_error& e) {
@@ -896,7 +7598,10 @@ int main() {
 		return EXIT_FAILURE;
 	}
 
-	int n;
-	std::cin >> n;
+	if (!options.headless) {
+		int n;
+		std::cin >> n;
+	}
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif
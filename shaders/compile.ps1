@@ -1,3 +1,9 @@
-$Compiler = "C:\Program Files\VulkanSDK\1.0.54.0\Bin\glslangValidator.exe"
+$Compiler = if ($env:VULKAN_SDK) { "$env:VULKAN_SDK\Bin\glslangValidator.exe" } else { "C:\Program Files\VulkanSDK\1.2.131.2\Bin\glslangValidator.exe" }
 &$Compiler -V triangle.vert
 &$Compiler -V triangle.frag
+&$Compiler -V cull.comp -o cull.spv
+&$Compiler -V fullscreen.vert -o fullscreen.spv
+&$Compiler -V composite.frag -o composite.spv
+&$Compiler -V upscale.frag -o upscale.spv
+&$Compiler -V particles.comp -o particles.spv
+&$Compiler -V particle.vert -o particle.spv
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+  vec4 gl_Position;
+  float gl_PointSize;
+};
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec4 inColor;
+
+layout(push_constant) uniform View {
+  vec2 center;
+  float zoom;
+  uint instanceCount;
+} view;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+  gl_Position = vec4((inPosition - view.center) * view.zoom, 0.0, 1.0);
+  gl_PointSize = 1.0;
+  fragColor = inColor.rgb;
+}
@@ -5,17 +5,30 @@ out gl_PerVertex {
   vec4 gl_Position;
 };
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 2) in vec2 instanceOffset;
+layout(location = 3) in vec2 instanceScaleRotation;
+layout(location = 4) in vec4 instanceColor;
 
-vec3 colors[3] = vec3[](vec3(1.0, 0.0, 0.0),
-                        vec3(0.0, 1.0, 0.0),
-                        vec3(0.0, 0.0, 1.0));
+layout(push_constant) uniform View {
+  vec2 center;
+  float zoom;
+  uint instanceCount;
+} view;
 
-vec2 positions[3] = vec2[](vec2( 0.0, -0.5),
-                           vec2( 0.5,  0.5),
-                           vec2(-0.5,  0.5));
+layout(set = 0, binding = 0) uniform Object {
+  vec2 offset;
+  float brightness;
+} object;
+
+layout(location = 0) out vec3 fragColor;
 
 void main() {
-  gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-  fragColor = colors[gl_VertexIndex];
+  float s = sin(instanceScaleRotation.y);
+  float c = cos(instanceScaleRotation.y);
+  vec2 position = mat2(c, s, -s, c) * inPosition * instanceScaleRotation.x;
+  gl_Position = vec4((position + instanceOffset + object.offset - view.center) * view.zoom, 0.0, 1.0);
+  fragColor = inColor * instanceColor.rgb * object.brightness;
 }
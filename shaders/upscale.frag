@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform sampler2D sceneColor;
+
+// The scene was drawn into the top-left part of its target; see UpscaleConstants.
+layout(push_constant) uniform Upscale {
+  vec2 uvScale;
+  vec2 uvMax;
+} upscale;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+  outColor = texture(sceneColor, min(gl_FragCoord.xy * upscale.uvScale, upscale.uvMax));
+}